@@ -4,6 +4,11 @@
 // the driver.  It shows how to send pulses to the STEP pin to step the motor
 // and how to switch directions using the DIR pin.
 //
+// The library drives the STEP and DIR pins itself: HPSDStepEngine generates
+// each pulse from a hardware timer interrupt with fast GPIO, and the timer also
+// provides the DRV8711's minimum pulse width and DIR setup time, so the CPU
+// does not spend several microseconds per step waiting in delayMicroseconds().
+//
 // Before using this example, be sure to change the setCurrentMilliamps36v4 line
 // to have an appropriate current limit for your system.  Also, see this
 // library's documentation for information about how to connect the driver:
@@ -11,6 +16,7 @@
 
 #include <SPI.h>
 #include <HighPowerStepperDriver.h>
+#include <HPSDStepEngine.h>
 
 const uint8_t DirPin = D0;
 const uint8_t StepPin = D1;
@@ -23,17 +29,17 @@ const uint8_t CSPin = A2;
 const uint16_t StepPeriodUs = 2000;
 
 HighPowerStepperDriver sd;
+HPSDStepEngine engine;
 
 void setup()
 {
   SPI.begin();
   sd.setChipSelectPin(CSPin);
 
-  // Drive the STEP and DIR pins low initially.
-  pinMode(StepPin, OUTPUT);
-  digitalWrite(StepPin, LOW);
-  pinMode(DirPin, OUTPUT);
-  digitalWrite(DirPin, LOW);
+  // Let the library drive the STEP and DIR pins (it sets them low initially),
+  // and start the step engine on them.
+  sd.setStepDirPins(StepPin, DirPin);
+  engine.begin(sd);
 
   // Give the driver some time to power up.
   delay(1);
@@ -61,46 +67,25 @@ void setup()
 void loop()
 {
   // Step in the default direction 1000 times.
-  setDirection(0);
-  for(unsigned int x = 0; x < 1000; x++)
-  {
-    step();
-    delayMicroseconds(StepPeriodUs);
-  }
+  engine.runBy(1000, StepPeriodUs);
+  waitForMove();
 
   // Wait for 300 ms.
   delay(300);
 
   // Step in the other direction 1000 times.
-  setDirection(1);
-  for(unsigned int x = 0; x < 1000; x++)
-  {
-    step();
-    delayMicroseconds(StepPeriodUs);
-  }
+  engine.runBy(-1000, StepPeriodUs);
+  waitForMove();
 
   // Wait for 300 ms.
   delay(300);
 }
 
-// Sends a pulse on the STEP pin to tell the driver to take one step, and also
-//delays to control the speed of the motor.
-void step()
+// Waits for the step engine to finish its move.  The steps are generated in the
+// background, so a real application could do other work here instead.
+void waitForMove()
 {
-  // The STEP minimum high pulse width is 1.9 microseconds.
-  digitalWrite(StepPin, HIGH);
-  delayMicroseconds(3);
-  digitalWrite(StepPin, LOW);
-  delayMicroseconds(3);
-}
-
-// Writes a high or low value to the direction pin to specify what direction to
-// turn the motor.
-void setDirection(bool dir)
-{
-  // The STEP pin must not change for at least 200 nanoseconds before and after
-  // changing the DIR pin.
-  delayMicroseconds(1);
-  digitalWrite(DirPin, dir);
-  delayMicroseconds(1);
+  while (engine.isMoving())
+  {
+  }
 }
@@ -0,0 +1,250 @@
+// This example measures how long this library's register I/O and stepping take
+// on your device, so you can compare boards, SPI clock speeds, and transports,
+// and spot regressions after changing the library.
+//
+// For each SPI clock speed, it times readReg(), writeReg() (blocking),
+// writeRegAsync() (DMA), writeRegs() (one batched transaction),
+// applySettings(), verifySettings(), and SPI stepping with step(), in
+// nanoseconds per operation.  At each clock speed, it also runs the step engine
+// on the STEP pin as fast as it goes while verifySettings() keeps the SPI bus
+// busy, and reports the step rate it managed and any timer overruns, since
+// register traffic is what delays steps in a real application.  Finally, with
+// the bus idle, it times a pinSetFast()/pinResetFast() pair and the CPU time
+// the step engine's timer interrupt takes per step.  The results are printed
+// over USB serial.
+//
+// The driver outputs stay disabled the whole time, so the motor does not move
+// even though the indexer is stepped.  The register writes only rewrite values
+// the driver already has.
+//
+// See this library's documentation for information about how to connect the
+// driver:
+//   http://pololu.github.io/high-power-stepper-driver
+
+#include <SPI.h>
+#include <HighPowerStepperDriver.h>
+#include <HPSDStepEngine.h>
+
+const uint8_t DirPin = D0;
+const uint8_t StepPin = D1;
+const uint8_t CSPin = A2;
+
+// The number of times each operation is repeated.
+const uint16_t Iterations = 200;
+
+// The SPI clock speeds to test, in Hz.
+const uint32_t ClockSpeeds[] = { 500000, 1000000, 2000000, 4000000 };
+
+HighPowerStepperDriver sd;
+HPSDStepEngine engine;
+
+// The time at which the operation being measured started, in CPU cycles.
+uint32_t startTicks;
+
+void setup()
+{
+  Serial.begin(115200);
+  SPI.begin();
+  sd.setChipSelectPin(CSPin);
+  sd.setStepDirPins(StepPin, DirPin);
+  engine.begin(sd);
+
+  // Give the driver some time to power up.
+  delay(1);
+
+  sd.resetSettings();
+  sd.clearStatus();
+  sd.disableDriver();
+
+  // Give the serial monitor time to connect.
+  delay(3000);
+}
+
+void loop()
+{
+  Serial.println();
+  Serial.printlnf("Nanoseconds per operation, %u iterations", Iterations);
+  Serial.println("clock    read  write  async  batch7  apply verify  step  steps/s overruns");
+
+  for (uint32_t hz : ClockSpeeds)
+  {
+    sd.driver.setClockSpeed(hz);
+    if (!sd.verifySettings())
+    {
+      Serial.printlnf("%7lu  settings do not verify at this speed", hz);
+      continue;
+    }
+
+    uint32_t read = benchmarkRead();
+    uint32_t write = benchmarkWrite();
+    uint32_t async = benchmarkAsync();
+    uint32_t batch = benchmarkBatch();
+    uint32_t apply = benchmarkApply();
+    uint32_t verify = benchmarkVerify();
+    uint32_t step = benchmarkSpiStep();
+    uint32_t overruns;
+    uint32_t stepRate = benchmarkStepRate(overruns);
+    Serial.printlnf("%7lu %6lu %6lu %6lu %7lu %6lu %6lu %5lu %8lu %8lu",
+      hz, read, write, async, batch, apply, verify, step, stepRate, overruns);
+  }
+  sd.driver.setClockSpeed(HPSD_SPI_DEFAULT_CLOCK);
+
+  Serial.println();
+  Serial.println("With no SPI traffic:");
+  Serial.printlnf("STEP pin pulse (pinSetFast + pinResetFast): %lu ns", benchmarkPinPulse());
+  Serial.printlnf("Step engine interrupt time per step: %lu ns", benchmarkEngine());
+  Serial.printlnf("Step timer overruns: %lu", engine.timer.getOverrunCount());
+
+  delay(10000);
+}
+
+void startTiming()
+{
+  startTicks = System.ticks();
+}
+
+// Returns the time since startTiming() per iteration, in nanoseconds.
+uint32_t stopTiming(uint32_t iterations)
+{
+  uint32_t ticks = System.ticks() - startTicks;
+  return (uint64_t)ticks * 1000 / System.ticksPerMicrosecond() / iterations;
+}
+
+uint32_t benchmarkRead()
+{
+  startTiming();
+  for (uint16_t i = 0; i < Iterations; i++)
+  {
+    sd.driver.readReg(HPSDRegAddr::OFF);
+  }
+  return stopTiming(Iterations);
+}
+
+uint32_t benchmarkWrite()
+{
+  uint16_t off = sd.getConfig().off;
+  startTiming();
+  for (uint16_t i = 0; i < Iterations; i++)
+  {
+    sd.driver.writeReg(HPSDRegAddr::OFF, off);
+  }
+  return stopTiming(Iterations);
+}
+
+uint32_t benchmarkAsync()
+{
+  // This measures the time until the frames are all sent, including waiting
+  // for the DMA, so it shows the throughput of the asynchronous queue rather
+  // than the (much smaller) time the CPU spends queuing.
+  uint16_t off = sd.getConfig().off;
+  startTiming();
+  for (uint16_t i = 0; i < Iterations; i++)
+  {
+    while (!sd.driver.writeRegAsync(HPSDRegAddr::OFF, off)) {}
+  }
+  sd.driver.finishAsync();
+  return stopTiming(Iterations);
+}
+
+uint32_t benchmarkBatch()
+{
+  HPSDConfig config = sd.getConfig();
+  const HPSDRegWrite writes[] = {
+    { HPSDRegAddr::TORQUE, config.torque },
+    { HPSDRegAddr::OFF,    config.off },
+    { HPSDRegAddr::BLANK,  config.blank },
+    { HPSDRegAddr::DECAY,  config.decay },
+    { HPSDRegAddr::DRIVE,  config.drive },
+    { HPSDRegAddr::STALL,  config.stall },
+    { HPSDRegAddr::CTRL,   config.ctrl },
+  };
+  startTiming();
+  for (uint16_t i = 0; i < Iterations; i++)
+  {
+    sd.driver.writeRegs(writes, 7);
+  }
+  return stopTiming(Iterations);
+}
+
+uint32_t benchmarkApply()
+{
+  startTiming();
+  for (uint16_t i = 0; i < Iterations; i++)
+  {
+    sd.applySettings();
+  }
+  return stopTiming(Iterations);
+}
+
+uint32_t benchmarkVerify()
+{
+  startTiming();
+  for (uint16_t i = 0; i < Iterations; i++)
+  {
+    sd.verifySettings();
+  }
+  return stopTiming(Iterations);
+}
+
+uint32_t benchmarkSpiStep()
+{
+  startTiming();
+  for (uint16_t i = 0; i < Iterations; i++)
+  {
+    sd.step();
+  }
+  return stopTiming(Iterations);
+}
+
+// Runs the step engine at its shortest period while reading back the
+// settings over SPI, and returns the step rate achieved in steps per second.
+// @p overruns is set to the number of timer overruns during the run.
+uint32_t benchmarkStepRate(uint32_t & overruns)
+{
+  const uint32_t Steps = 5000;
+
+  uint32_t overrunsBefore = engine.timer.getOverrunCount();
+  uint32_t start = micros();
+  engine.run(Steps, HPSDStepEngine::MinStepPeriodUs);
+  while (engine.isRunning())
+  {
+    sd.verifySettings();
+  }
+  uint32_t elapsedUs = micros() - start;
+  overruns = engine.timer.getOverrunCount() - overrunsBefore;
+  return (uint64_t)Steps * 1000000 / elapsedUs;
+}
+
+uint32_t benchmarkPinPulse()
+{
+  startTiming();
+  for (uint16_t i = 0; i < Iterations; i++)
+  {
+    pinSetFast(StepPin);
+    pinResetFast(StepPin);
+  }
+  return stopTiming(Iterations);
+}
+
+// Measures the CPU time the step engine's interrupt uses per step by counting
+// how many cycles of a busy loop it steals while stepping.
+uint32_t benchmarkEngine()
+{
+  const uint32_t Steps = 2000;
+  const uint32_t PeriodUs = 100;
+
+  // Time an idle loop of the same length first.
+  uint32_t idleLoops = 0;
+  uint32_t start = micros();
+  while (micros() - start < Steps * PeriodUs) { idleLoops++; }
+
+  uint32_t busyLoops = 0;
+  engine.run(Steps, PeriodUs);
+  start = micros();
+  while (micros() - start < Steps * PeriodUs) { busyLoops++; }
+  engine.stop();
+
+  if (busyLoops >= idleLoops) { return 0; }
+  uint64_t stolenNs = (uint64_t)(idleLoops - busyLoops) * Steps * PeriodUs * 1000 / idleLoops;
+  return stolenNs / Steps;
+}
@@ -0,0 +1,88 @@
+// This example shows how to step a Pololu High Power Stepper Motor Driver from
+// a hardware timer with the HPSDStepEngine class.
+//
+// It configures the driver the same way as the BasicStepping example, but
+// instead of toggling the STEP pin and waiting in delayMicroseconds(), it
+// hands each move to the step engine and returns to loop() right away, so the
+// application thread stays free for networking and other work while the motor
+// turns.  Each move accelerates to its top speed and decelerates to a stop, so
+// the motor can go faster than a fixed step period allows without missing
+// steps.  The engine keeps track of the motor's position, and the moves go back
+// and forth between two absolute positions.  The direction is set over SPI, so
+// the DIR pin does not need to be connected.
+//
+// Before using this example, be sure to change the setCurrentMilliamps36v4 line
+// to have an appropriate current limit for your system.  Also, see this
+// library's documentation for information about how to connect the driver:
+//   http://pololu.github.io/high-power-stepper-driver
+
+#include <SPI.h>
+#include <HighPowerStepperDriver.h>
+#include <HPSDStepEngine.h>
+
+const uint8_t StepPin = D1;
+const uint8_t CSPin = A2;
+
+// The top speed of each move, in steps per second, and the acceleration used to
+// get there, in steps per second per second.  If the motor misses steps, try
+// lowering the acceleration.
+const uint32_t MaxSpeed = 4000;
+const uint32_t Acceleration = 8000;
+
+HighPowerStepperDriver sd;
+HPSDStepEngine engine;
+
+uint32_t moveDoneMs = 0;
+
+void setup()
+{
+  SPI.begin();
+  sd.setChipSelectPin(CSPin);
+  engine.begin(StepPin);
+  engine.setDriver(&sd);
+  engine.setMotionLimits(MaxSpeed, Acceleration);
+
+  // Give the driver some time to power up.
+  delay(1);
+
+  // Reset the driver to its default settings and clear latched status
+  // conditions.
+  sd.resetSettings();
+  sd.clearStatus();
+
+  // Select auto mixed decay.  TI's DRV8711 documentation recommends this mode
+  // for most applications, and we find that it usually works well.
+  sd.setDecayMode(HPSDDecayMode::AutoMixed);
+
+  // Set the current limit. You should change the number here to an appropriate
+  // value for your particular system.
+  sd.setCurrentMilliamps36v4(1000);
+
+  // Set the number of microsteps that correspond to one full step.
+  sd.setStepMode(HPSDStepMode::MicroStep32);
+
+  // Enable the motor outputs.
+  sd.enableDriver();
+}
+
+void loop()
+{
+  if (engine.isMoving())
+  {
+    // The motor is moving; do other work here.
+    return;
+  }
+
+  if (moveDoneMs == 0)
+  {
+    moveDoneMs = millis();
+  }
+
+  // Wait for 300 ms after each move, then move to the other end of the
+  // 1000-step range.
+  if (millis() - moveDoneMs >= 300)
+  {
+    engine.moveTo(engine.getPosition() == 0 ? 1000 : 0);
+    moveDoneMs = 0;
+  }
+}
@@ -0,0 +1,234 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDBrownoutRecovery.h
+///
+/// This file defines the HPSDBrownoutRecovery class, which notices when
+/// drivers lose their settings and restores them without blocking.
+
+#pragma once
+
+#include <Arduino.h>
+#include "HighPowerStepperDriver.h"
+#include "HPSDStepEngine.h"
+
+/// The type of function that HPSDBrownoutRecovery calls when an axis has
+/// recovered.
+typedef void (*HPSDRecoveryCallback)(void * context, uint8_t axis);
+
+/// This class watches up to @p MaxAxes drivers for a loss of settings and
+/// brings each one back with a small state machine:
+///
+/// 1. **Watching:** each service() call does one step of
+///    HighPowerStepperDriver::verifyNext() (one SPI frame), without letting
+///    it repair anything.  If STATUS shows undervoltage lockout or a register
+///    does not match, the axis's engine is stopped, since its steps are no
+///    longer reaching the motor, and the other axes are made to read STATUS
+///    on their next call, since a supply dip usually hits all of them.
+/// 2. **Restoring:** every setting is written in one SPI transaction with the
+///    outputs disabled, and UVLO is cleared.
+/// 3. **Settling:** after the settle time, STATUS and the settings are read
+///    back.  If the supply dipped again, the axis goes back to restoring;
+///    otherwise the driver is enabled again if it was enabled before, and the
+///    recovery callback is called.
+///
+/// All axes advance through their states in the same service() call, so a dip
+/// that resets every driver costs one settle time in total rather than one
+/// per axis.
+///
+/// The engine's position is the number of steps that were actually taken
+/// before it was stopped, and the direction is restored along with the rest
+/// of CTRL (the DIR pin is not affected by a driver reset).  A reset also puts
+/// the DRV8711's indexer back to its home state, so the motor can end up as
+/// much as two full steps from where the position says; re-home if that
+/// matters.  getInterruptedSteps() returns how many steps the stopped move
+/// had left, so the callback can resume it.
+///
+/// Example usage:
+/// ~~~{.cpp}
+/// HPSDBrownoutRecovery<2> recovery;
+///
+/// void setup()
+/// {
+///   recovery.addAxis(sdX, &engineX);
+///   recovery.addAxis(sdY, &engineY);
+/// }
+///
+/// void loop()
+/// {
+///   recovery.service();
+/// }
+/// ~~~
+template <uint8_t MaxAxes> class HPSDBrownoutRecovery
+{
+  static_assert(MaxAxes >= 1 && MaxAxes <= 32, "HPSDBrownoutRecovery supports 1 to 32 axes.");
+
+public:
+  /// The recovery states of an axis.
+  enum class State : uint8_t
+  {
+    Watching,
+    Restoring,
+    Settling,
+  };
+
+  /// Adds a driver to watch, along with the engine that steps it (or null).
+  ///
+  /// @return The index of the new axis, or -1 if there are already
+  /// @p MaxAxes axes.
+  int8_t addAxis(HighPowerStepperDriver & sd, HPSDStepEngine * engine = nullptr)
+  {
+    if (axisCount >= MaxAxes) { return -1; }
+    Axis & axis = axes[axisCount];
+    axis.driver = &sd;
+    axis.engine = engine;
+    axis.state = State::Watching;
+    axis.wasEnabled = false;
+    axis.interruptedSteps = 0;
+    axis.recoveryCount = 0;
+    axis.since = 0;
+    sd.restartVerify();
+    return axisCount++;
+  }
+
+  /// Sets how long to wait after restoring the settings before checking them
+  /// and enabling the driver, in milliseconds.  The default is 10 ms.
+  void setSettleTime(uint32_t ms)
+  {
+    settleMs = ms;
+  }
+
+  /// Sets a function to call from service() each time an axis has recovered,
+  /// or null for none.
+  void setRecoveryCallback(HPSDRecoveryCallback callback, void * context = nullptr)
+  {
+    this->callback = callback;
+    this->context = context;
+  }
+
+  /// Advances every axis's state machine by one step.  Call this regularly
+  /// from your main loop, not from an interrupt.
+  void service()
+  {
+    for (uint8_t i = 0; i < axisCount; i++)
+    {
+      Axis & axis = axes[i];
+      switch (axis.state)
+      {
+      case State::Watching: watch(i); break;
+      case State::Restoring: restore(axis); break;
+      case State::Settling: settle(i); break;
+      }
+    }
+  }
+
+  /// Returns the state of the specified axis.
+  State getState(uint8_t axis) const
+  {
+    return axes[axis].state;
+  }
+
+  /// Returns true if any axis is recovering.
+  bool isRecovering() const
+  {
+    for (uint8_t i = 0; i < axisCount; i++)
+    {
+      if (axes[i].state != State::Watching) { return true; }
+    }
+    return false;
+  }
+
+  /// Returns the number of steps the specified axis's engine had left when it
+  /// was stopped by the last recovery, or 0 if it was not moving.
+  uint32_t getInterruptedSteps(uint8_t axis) const
+  {
+    return axes[axis].interruptedSteps;
+  }
+
+  /// Returns the number of times the specified axis has recovered.
+  uint32_t getRecoveryCount(uint8_t axis) const
+  {
+    return axes[axis].recoveryCount;
+  }
+
+protected:
+
+  struct Axis
+  {
+    HighPowerStepperDriver * driver;
+    HPSDStepEngine * engine;
+    State state;
+    bool wasEnabled;
+    uint32_t interruptedSteps;
+    uint32_t recoveryCount;
+    uint32_t since;
+  };
+
+  void watch(uint8_t index)
+  {
+    Axis & axis = axes[index];
+    HPSDVerifyResult result = axis.driver->verifyNext(false);
+    if (result != HPSDVerifyResult::Undervoltage && result != HPSDVerifyResult::Mismatch)
+    {
+      return;
+    }
+
+    axis.interruptedSteps = 0;
+    if (axis.engine != nullptr)
+    {
+      ATOMIC_BLOCK()
+      {
+        if (axis.engine->isRunning()) { axis.interruptedSteps = axis.engine->getStepsRemaining(); }
+        axis.engine->stop();
+      }
+    }
+    axis.wasEnabled = axis.driver->getEnabled();
+    axis.state = State::Restoring;
+
+    // Have the other axes check STATUS next rather than finishing their
+    // passes, since they probably share the supply.
+    for (uint8_t i = 0; i < axisCount; i++)
+    {
+      if (i != index && axes[i].state == State::Watching) { axes[i].driver->restartVerify(); }
+    }
+
+    restore(axis);
+  }
+
+  void restore(Axis & axis)
+  {
+    HighPowerStepperDriver & sd = *axis.driver;
+    sd.beginUpdate();
+    sd.disableDriver();
+    sd.applySettings();
+    sd.commit();
+    sd.driver.writeReg(HPSDRegAddr::STATUS, ~(1 << (uint8_t)HPSDStatusBit::UVLO));
+
+    axis.since = millis();
+    axis.state = State::Settling;
+  }
+
+  void settle(uint8_t index)
+  {
+    Axis & axis = axes[index];
+    if (millis() - axis.since < settleMs) { return; }
+
+    HighPowerStepperDriver & sd = *axis.driver;
+    if ((sd.readStatus() & (1 << (uint8_t)HPSDStatusBit::UVLO)) || !sd.verifySettings())
+    {
+      axis.state = State::Restoring;
+      return;
+    }
+
+    if (axis.wasEnabled) { sd.enableDriver(); }
+    sd.restartVerify();
+    axis.recoveryCount++;
+    axis.state = State::Watching;
+    if (callback != nullptr) { callback(context, index); }
+  }
+
+  Axis axes[MaxAxes];
+  uint8_t axisCount = 0;
+  uint32_t settleMs = 10;
+  HPSDRecoveryCallback callback = nullptr;
+  void * context = nullptr;
+};
@@ -0,0 +1,144 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDDecaySchedule.h
+///
+/// This file defines the HPSDDecaySchedule class, which changes a driver's
+/// current decay settings with the speed of an HPSDStepEngine.
+
+#pragma once
+
+#include <Arduino.h>
+#include "HighPowerStepperDriver.h"
+#include "HPSDStepEngine.h"
+
+/// One row of an HPSDDecaySchedule table: the current chopper settings to use
+/// from @p minSpeed (in steps per second) up to the next row's speed.
+struct HPSDDecayBand
+{
+  uint32_t minSpeed;
+  HPSDDecayMode mode;
+
+  /// Mixed decay transition time (TDECAY); see
+  /// HighPowerStepperDriver::setDecayTime().
+  uint8_t decayTime;
+
+  /// Fixed off time (TOFF); see HighPowerStepperDriver::setOffTime().
+  uint8_t offTime;
+
+  /// Current trip blanking time (TBLANK); see
+  /// HighPowerStepperDriver::setBlankTime().
+  uint8_t blankTime;
+};
+
+/// This class applies the row of a speed-indexed table of DECAY, OFF, and
+/// BLANK settings that matches the current speed of an HPSDStepEngine.
+///
+/// The table rows must be sorted by increasing minSpeed, and the first row
+/// normally has a minSpeed of 0.  The schedule moves up a row as soon as the
+/// speed reaches the next row's minSpeed, but only moves back down once the
+/// speed is below the current row's minSpeed by more than the hysteresis, so
+/// a speed hovering around a threshold does not cause a stream of writes.
+///
+/// Each change is written with HighPowerStepperDriver::beginUpdate() and
+/// commit(), so only the registers that differ are sent, in one SPI
+/// transaction.  The step pulses come from the timer interrupt and are not
+/// held up by it.  Like HPSDPhaseCurrent, the switching happens in service(),
+/// which you should call often from your main loop.
+///
+/// Example usage:
+/// ~~~{.cpp}
+/// const HPSDDecayBand DecayTable[] = {
+///   {    0, HPSDDecayMode::AutoMixed, 0x10, 0x30, 0x80 },
+///   { 2000, HPSDDecayMode::Mixed,     0x08, 0x18, 0x60 },
+///   { 6000, HPSDDecayMode::Fast,      0x00, 0x10, 0x40 },
+/// };
+/// HPSDDecaySchedule decaySchedule;
+///
+/// void setup()
+/// {
+///   decaySchedule.begin(sd, engine, DecayTable, 3, 200);
+/// }
+///
+/// void loop()
+/// {
+///   decaySchedule.service();
+/// }
+/// ~~~
+class HPSDDecaySchedule
+{
+public:
+  /// Sets the driver, engine, and table to use and applies the row for the
+  /// engine's current speed.
+  ///
+  /// The table is not copied, so it must stay valid.  @p hysteresis is in
+  /// steps per second.
+  void begin(HighPowerStepperDriver & sd, HPSDStepEngine & engine,
+    const HPSDDecayBand * bands, uint8_t bandCount, uint32_t hysteresis)
+  {
+    this->sd = &sd;
+    this->engine = &engine;
+    this->bands = bands;
+    this->bandCount = bandCount;
+    this->hysteresis = hysteresis;
+    index = 0;
+    if (bandCount == 0) { return; }
+
+    index = findBand(engine.getSpeed(), 0);
+    apply();
+  }
+
+  /// Applies a different row of the table if the engine's speed has crossed a
+  /// threshold.  Call this from your main loop, not from an interrupt.
+  void service()
+  {
+    if (bandCount == 0) { return; }
+
+    uint8_t wanted = findBand(engine->getSpeed(), index);
+    if (wanted != index)
+    {
+      index = wanted;
+      apply();
+    }
+  }
+
+  /// Returns the index of the table row that was applied last.
+  uint8_t getBand() const
+  {
+    return index;
+  }
+
+protected:
+
+  /// Returns the row for @p speed, starting from row @p from.
+  uint8_t findBand(uint32_t speed, uint8_t from) const
+  {
+    uint8_t i = from;
+    while (i + 1 < bandCount && speed >= bands[i + 1].minSpeed)
+    {
+      i++;
+    }
+    while (i > 0 && speed + hysteresis < bands[i].minSpeed)
+    {
+      i--;
+    }
+    return i;
+  }
+
+  void apply()
+  {
+    const HPSDDecayBand & band = bands[index];
+    sd->beginUpdate();
+    sd->setDecayMode(band.mode);
+    sd->setDecayTime(band.decayTime);
+    sd->setOffTime(band.offTime);
+    sd->setBlankTime(band.blankTime);
+    sd->commit();
+  }
+
+  HighPowerStepperDriver * sd = nullptr;
+  HPSDStepEngine * engine = nullptr;
+  const HPSDDecayBand * bands = nullptr;
+  uint8_t bandCount = 0;
+  uint8_t index = 0;
+  uint32_t hysteresis = 0;
+};
@@ -0,0 +1,180 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDHoming.h
+///
+/// This file defines the HPSDHoming class, which homes an axis without a limit
+/// switch by driving it into a hard stop and detecting the stall.
+
+#pragma once
+
+#include <Arduino.h>
+#include "HighPowerStepperDriver.h"
+#include "HPSDStepEngine.h"
+
+/// This class runs a sensorless homing move using the DRV8711's back-EMF
+/// stall detection.
+///
+/// start() configures stall detection, sets the direction, and starts a move
+/// toward the hard stop with the step engine.  When the driver's STALLn pin
+/// goes low, the pin interrupt stops the engine immediately, so no further
+/// steps are taken into the stop.  Stalls reported while the move is still
+/// accelerating are ignored, since the back EMF is too low at low speeds to
+/// be meaningful.
+///
+/// The driver's STALLn pin must be attached with
+/// HighPowerStepperDriver::attachStallPin().  While homing, this class uses
+/// the driver's pin event callback (see
+/// HighPowerStepperDriver::setPinEventCallback()), and it clears the callback
+/// when homing finishes.
+///
+/// Example usage:
+/// ~~~{.cpp}
+/// HPSDHoming homing;
+///
+/// void setup()
+/// {
+///   sd.attachStallPin(StallPin);
+///   homing.begin(sd, engine);
+///   homing.start(true, 800, 4000, 20000, 40);
+/// }
+///
+/// void loop()
+/// {
+///   if (homing.service() == HPSDHoming::State::Homed)
+///   {
+///     // The axis is against its hard stop.
+///   }
+/// }
+/// ~~~
+class HPSDHoming
+{
+public:
+  /// The states of a homing move.
+  enum class State : uint8_t
+  {
+    /// No homing move has been started.
+    Idle,
+
+    /// The axis is moving toward the hard stop.
+    Running,
+
+    /// A stall was detected and the axis stopped.  The engine's position is
+    /// set to 0.
+    Homed,
+
+    /// The move ended without detecting a stall.
+    Failed,
+  };
+
+  /// Sets the driver and step engine to use.
+  void begin(HighPowerStepperDriver & sd, HPSDStepEngine & engine)
+  {
+    this->sd = &sd;
+    this->engine = &engine;
+    state = State::Idle;
+  }
+
+  /// Starts a homing move.
+  ///
+  /// @param reverse The direction to move in (RDIR).
+  /// @param speed The homing speed in steps per second.
+  /// @param accel The acceleration in steps per second squared.
+  /// @param maxSteps How far to move before giving up.
+  /// @param threshold The stall detection threshold (SDTHR); see
+  ///   HighPowerStepperDriver::setStallDetection().
+  /// @param count The stall detection step count (SDCNT).
+  /// @param divider The back-EMF divider (VDIV).
+  void start(bool reverse, uint32_t speed, uint32_t accel, uint32_t maxSteps,
+    uint8_t threshold, HPSDStallCount count = HPSDStallCount::Steps1,
+    HPSDBemfDivider divider = HPSDBemfDivider::Div32)
+  {
+    if (sd == nullptr) { return; }
+
+    engine->stop();
+    sd->setStallDetection(threshold, count, divider);
+    engine->setDirection(reverse);
+    sd->clearStatus();
+
+    stalled = false;
+    state = State::Running;
+    sd->setPinEventCallback(onPinEvent, this);
+
+    engine->move(maxSteps, speed, accel);
+  }
+
+  /// Aborts a homing move in progress.
+  void cancel()
+  {
+    if (state != State::Running) { return; }
+    engine->stop();
+    finish(State::Idle);
+  }
+
+  /// Updates the state of the homing move and returns it.  Call this from your
+  /// main loop while homing.
+  State service()
+  {
+    if (state == State::Running)
+    {
+      if (stalled)
+      {
+        finish(State::Homed);
+      }
+      else if (!engine->isRunning())
+      {
+        finish(State::Failed);
+      }
+    }
+    return state;
+  }
+
+  /// Returns the state of the homing move.
+  State getState() const
+  {
+    return state;
+  }
+
+  /// Returns the number of steps that were left in the homing move when it
+  /// stopped.
+  uint32_t getStepsRemaining() const
+  {
+    return stepsRemaining;
+  }
+
+protected:
+
+  static void onPinEvent(void * context, HPSDPinEvent event)
+  {
+    ((HPSDHoming *)context)->pinEvent(event);
+  }
+
+  /// Called from the pin interrupt.
+  void pinEvent(HPSDPinEvent event)
+  {
+    if (event != HPSDPinEvent::Stall || stalled) { return; }
+    if (!engine->isRunning() || engine->planner.isAccelerating()) { return; }
+
+    stepsRemaining = engine->getStepsRemaining();
+    engine->stop();
+    stalled = true;
+  }
+
+  void finish(State result)
+  {
+    sd->setPinEventCallback(nullptr);
+    if (result != State::Homed) { stepsRemaining = engine->getStepsRemaining(); }
+
+    // The hard stop is the new origin.
+    if (result == State::Homed) { engine->setPosition(0); }
+
+    // Leave the latched stall bits clear for the next move.
+    sd->clearStatus();
+    state = result;
+  }
+
+  HighPowerStepperDriver * sd = nullptr;
+  HPSDStepEngine * engine = nullptr;
+  volatile bool stalled = false;
+  volatile State state = State::Idle;
+  volatile uint32_t stepsRemaining = 0;
+};
@@ -0,0 +1,213 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDHybridStepper.h
+///
+/// This file defines the HPSDHybridStepper class, which steps a driver over
+/// SPI at low rates and with its STEP pin at high rates.
+
+#pragma once
+
+#include <Arduino.h>
+#include "HighPowerStepperDriver.h"
+#include "HPSDStepEngine.h"
+
+/// This class runs constant-speed moves for one driver with whichever step
+/// backend suits the rate:
+///
+/// - Below the crossover speed, each step is an SPI write of CTRL with RSTEP
+///   set (HighPowerStepperDriver::step()), issued from service().  This needs
+///   no STEP wiring and no timer, but each step costs an SPI transaction and
+///   its timing is only as good as the main loop's.
+/// - At or above the crossover speed, the steps are STEP pin pulses from the
+///   timer interrupt of an HPSDStepEngine, which costs no SPI time at all.
+///
+/// If setSpeed() moves a run across the crossover, the steps that are left
+/// are handed to the other backend without stopping.  Both backends count in
+/// the engine's position (HPSDStepEngine::getPosition()) and set the
+/// direction through HPSDStepEngine::setDirection(), so the DIR pin and the
+/// RDIR bit never disagree.
+///
+/// If the engine is null or has no STEP pin, every step goes over SPI.
+///
+/// Example usage:
+/// ~~~{.cpp}
+/// HPSDHybridStepper stepper;
+///
+/// void setup()
+/// {
+///   sd.setStepDirPins(StepPin, DirPin);
+///   engine.begin(sd);
+///   stepper.begin(sd, &engine, 500);
+///   stepper.run(-2000, 100);  // Slow jog over SPI.
+/// }
+///
+/// void loop()
+/// {
+///   stepper.service();
+/// }
+/// ~~~
+class HPSDHybridStepper
+{
+public:
+  /// Sets the driver and engine to use and the crossover speed in steps per
+  /// second.
+  void begin(HighPowerStepperDriver & sd, HPSDStepEngine * engine, uint32_t crossoverSpeed)
+  {
+    this->sd = &sd;
+    this->engine = engine;
+    this->crossoverSpeed = crossoverSpeed;
+    spiSteps = 0;
+  }
+
+  /// Changes the crossover speed.  It takes effect at the next run() or
+  /// setSpeed().
+  void setCrossoverSpeed(uint32_t speed)
+  {
+    crossoverSpeed = speed;
+  }
+
+  /// Starts taking @p steps steps at @p speed steps per second, in the
+  /// direction given by the sign of @p steps.  This replaces any run in
+  /// progress and returns immediately.
+  void run(int32_t steps, uint32_t speed)
+  {
+    stop();
+    if (speed == 0) { return; }
+    setDirection(steps < 0);
+    start(steps < 0 ? -steps : steps, speed);
+  }
+
+  /// Changes the speed of the run in progress, switching backends if the new
+  /// speed is on the other side of the crossover.
+  void setSpeed(uint32_t speed)
+  {
+    if (speed == 0) { stop(); return; }
+
+    if (!isMoving()) { return; }
+
+    if (wantPins(speed) == usingPins)
+    {
+      if (usingPins) { engine->setStepPeriod(periodFromSpeed(speed)); }
+      else { periodUs = periodFromSpeed(speed); }
+      return;
+    }
+
+    // Take over the remaining steps without letting the interrupt step in
+    // between.
+    uint32_t remaining;
+    ATOMIC_BLOCK()
+    {
+      remaining = getStepsRemaining();
+      stopBackend();
+    }
+    if (remaining) { start(remaining, speed); }
+  }
+
+  /// Stops immediately.  Steps that have not been taken are discarded.
+  void stop()
+  {
+    stopBackend();
+  }
+
+  /// Takes the next SPI step if it is due.  Call this as often as possible
+  /// from your main loop, not from an interrupt; SPI steps are only taken
+  /// here.
+  void service()
+  {
+    if (spiSteps == 0) { return; }
+
+    uint32_t now = micros();
+    if ((int32_t)(now - nextStepUs) < 0) { return; }
+
+    sd->step();
+    if (engine != nullptr)
+    {
+      engine->setPosition(engine->getPosition() + (reverse ? -1 : 1));
+    }
+    spiSteps--;
+
+    // Schedule from the deadline rather than from now so the rate stays
+    // right even if this is called late, but do not try to catch up on more
+    // than one step.
+    nextStepUs += periodUs;
+    if ((int32_t)(now - nextStepUs) > 0) { nextStepUs = now + periodUs; }
+  }
+
+  /// Returns true if a run is in progress.
+  bool isMoving() const
+  {
+    return getStepsRemaining() != 0;
+  }
+
+  /// Returns true if the run in progress is stepping with the STEP pin.
+  bool isUsingPins() const
+  {
+    return usingPins && engine->isRunning();
+  }
+
+  /// Returns the number of steps left in the run.
+  uint32_t getStepsRemaining() const
+  {
+    if (usingPins) { return engine->isRunning() ? engine->getStepsRemaining() : 0; }
+    return spiSteps;
+  }
+
+protected:
+
+  static uint32_t periodFromSpeed(uint32_t speed)
+  {
+    return (1000000 + speed / 2) / speed;
+  }
+
+  bool wantPins(uint32_t speed) const
+  {
+    return engine != nullptr && engine->getStepPin() != HPSD_NO_PIN && speed >= crossoverSpeed;
+  }
+
+  void setDirection(bool reverse)
+  {
+    this->reverse = reverse;
+    if (engine != nullptr)
+    {
+      engine->setDirection(reverse);
+    }
+    else
+    {
+      sd->setDirection(reverse);
+    }
+  }
+
+  void start(uint32_t steps, uint32_t speed)
+  {
+    usingPins = wantPins(speed);
+    if (usingPins)
+    {
+      engine->run(steps, periodFromSpeed(speed));
+    }
+    else
+    {
+      periodUs = periodFromSpeed(speed);
+      nextStepUs = micros();
+      spiSteps = steps;
+    }
+  }
+
+  void stopBackend()
+  {
+    if (usingPins && engine != nullptr)
+    {
+      engine->stop();
+    }
+    usingPins = false;
+    spiSteps = 0;
+  }
+
+  HighPowerStepperDriver * sd = nullptr;
+  HPSDStepEngine * engine = nullptr;
+  uint32_t crossoverSpeed = 0;
+  uint32_t periodUs = 0;
+  uint32_t nextStepUs = 0;
+  uint32_t spiSteps = 0;
+  bool usingPins = false;
+  bool reverse = false;
+};
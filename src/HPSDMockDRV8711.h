@@ -0,0 +1,252 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDMockDRV8711.h
+///
+/// This file defines the HPSDMockDRV8711 class, a software model of the
+/// DRV8711's SPI registers for running the library without hardware.
+
+#pragma once
+
+#include <stdint.h>
+#include "HPSDTransport.h"
+
+/// This class is an HPSDTransport that behaves like the registers of a
+/// DRV8711 instead of sending frames anywhere.
+///
+/// It models the parts of the register interface that the library depends
+/// on:
+///
+/// - Registers power up with their datasheet defaults, and only bits 11:0 of
+///   a write are kept.
+/// - TORQUE bit 10 is write-only and always reads back as 0.
+/// - Writing CTRL with RSTEP set advances the indexer one step, in the
+///   direction the DIR pin and RDIR select, and RSTEP reads back as 0.
+/// - STATUS bits are set by faults and cleared by writing 0 to them, except
+///   STD, which follows the stall condition.
+///
+/// It also counts frames per register, so tests can check how many SPI
+/// transactions an operation takes, and it can inject faults, stalls, and
+/// brownouts.  It is not a model of the motor or of the chopper timing.
+///
+/// Like HPSDTransport.h, this header depends only on `<stdint.h>`.  The rest
+/// of the library needs Device OS, so to run it on a PC, build it with the
+/// stand-ins in the `test/shim` folder; `test/Makefile` does this for the
+/// host tests and for a throughput profiler.
+///
+/// Example usage:
+/// ~~~{.cpp}
+/// HPSDMockDRV8711 mock;
+/// HighPowerStepperDriver sd;
+///
+/// sd.driver.setTransport(&mock);
+/// sd.resetSettings();
+/// mock.resetCounts();
+/// sd.setDirection(1);
+/// sd.step();
+/// // mock.getPosition() is now -1, and mock.getWriteCount() is 2.
+/// ~~~
+class HPSDMockDRV8711 : public HPSDTransport
+{
+public:
+  /// Register addresses, which match HPSDRegAddr.
+  enum Register : uint8_t
+  {
+    CTRL = 0, TORQUE = 1, OFF = 2, BLANK = 3, DECAY = 4, STALL = 5, DRIVE = 6, STATUS = 7,
+  };
+
+  /// STATUS bits, which match HPSDStatusBit.
+  enum StatusBit : uint8_t
+  {
+    OTS = 0, AOCP = 1, BOCP = 2, APDF = 3, BPDF = 4, UVLO = 5, STD = 6, STDLAT = 7,
+  };
+
+  HPSDMockDRV8711()
+  {
+    powerOn();
+    resetCounts();
+  }
+
+  /// Handles one frame as the DRV8711 would.  DRV8711SPI calls this; you
+  /// normally do not need to.
+  uint16_t transfer(uint16_t frame) override
+  {
+    uint8_t address = (frame >> 12) & 0b111;
+    if (frame & 0x8000)
+    {
+      reads[address]++;
+      return readRegister(address);
+    }
+
+    writes[address]++;
+    writeRegister(address, frame & 0xFFF);
+    // SDATO is not driven during a write.
+    return 0;
+  }
+
+  /// Returns what a read of the specified register would return.  This does
+  /// not count as a frame.
+  uint16_t readRegister(uint8_t address) const
+  {
+    address &= 0b111;
+    if (address == STATUS) { return status; }
+    if (address == TORQUE) { return regs[TORQUE] & ~(1 << 10); }
+    return regs[address];
+  }
+
+  /// Applies a write of the specified register.  This does not count as a
+  /// frame.
+  void writeRegister(uint8_t address, uint16_t value)
+  {
+    address &= 0b111;
+    value &= 0xFFF;
+
+    if (address == STATUS)
+    {
+      // Latched bits clear when 0 is written to them; STD is read-only.
+      status &= value | (1 << STD);
+      return;
+    }
+
+    if (address == CTRL && (value & (1 << 2)))
+    {
+      value &= ~(1 << 2);
+      regs[CTRL] = value;
+      step();
+      return;
+    }
+
+    regs[address] = value;
+  }
+
+  /// Returns the value stored in a register, including TORQUE bit 10, which
+  /// cannot be read over SPI.
+  uint16_t getRegister(uint8_t address) const
+  {
+    return (address & 0b111) == STATUS ? status : regs[address & 0b111];
+  }
+
+  /// Changes a stored register value without counting a frame or stepping,
+  /// for example to simulate a corrupted register.
+  void setRegister(uint8_t address, uint16_t value)
+  {
+    if ((address & 0b111) == STATUS) { status = value & 0xFF; }
+    else { regs[address & 0b111] = value & 0xFFF; }
+  }
+
+  /// Puts the registers back to their power-on defaults, clears STATUS, and
+  /// sets the indexer position to 0.  The frame counts are not changed.
+  void powerOn()
+  {
+    regs[CTRL]   = 0xC10;
+    regs[TORQUE] = 0x1FF;
+    regs[OFF]    = 0x030;
+    regs[BLANK]  = 0x080;
+    regs[DECAY]  = 0x110;
+    regs[STALL]  = 0x040;
+    regs[DRIVE]  = 0xA59;
+    status = 0;
+    position = 0;
+  }
+
+  /// Simulates a supply dip deep enough to reset the device: the registers
+  /// go back to their defaults and UVLO is latched in STATUS.
+  void brownout()
+  {
+    powerOn();
+    status |= 1 << UVLO;
+  }
+
+  /// Latches the specified STATUS bits, as if those faults had happened.
+  void setFaults(uint8_t bits)
+  {
+    status |= bits & ~(1 << STD);
+  }
+
+  /// Sets or clears the stall condition.  Setting it also latches STDLAT.
+  void setStalled(bool stalled)
+  {
+    if (stalled) { status |= (1 << STD) | (1 << STDLAT); }
+    else { status &= ~(1 << STD); }
+  }
+
+  /// Sets the level of the DIR pin, which the direction of every step is
+  /// combined with (along with RDIR).  The default is low.
+  void setDirPin(bool high)
+  {
+    dirPin = high;
+  }
+
+  /// Simulates a rising edge on the STEP pin.
+  void pulseStep()
+  {
+    step();
+  }
+
+  /// Returns the number of steps the indexer has taken, counting steps with
+  /// DIR low and RDIR 0 as positive, like HPSDStepEngine does.
+  int32_t getPosition() const
+  {
+    return position;
+  }
+
+  /// Returns true if ENBL is set in CTRL.
+  bool isEnabled() const
+  {
+    return regs[CTRL] & 1;
+  }
+
+  /// Returns the number of write frames to the specified register since the
+  /// last resetCounts().
+  uint32_t getWriteCount(uint8_t address) const
+  {
+    return writes[address & 0b111];
+  }
+
+  /// Returns the number of write frames to any register.
+  uint32_t getWriteCount() const
+  {
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < 8; i++) { total += writes[i]; }
+    return total;
+  }
+
+  /// Returns the number of read frames from the specified register since the
+  /// last resetCounts().
+  uint32_t getReadCount(uint8_t address) const
+  {
+    return reads[address & 0b111];
+  }
+
+  /// Returns the number of read frames from any register.
+  uint32_t getReadCount() const
+  {
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < 8; i++) { total += reads[i]; }
+    return total;
+  }
+
+  /// Sets all of the frame counts to 0.
+  void resetCounts()
+  {
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      reads[i] = 0;
+      writes[i] = 0;
+    }
+  }
+
+protected:
+
+  void step()
+  {
+    bool reverse = dirPin != (bool)(regs[CTRL] & (1 << 1));
+    position += reverse ? -1 : 1;
+  }
+
+  uint16_t regs[7];
+  uint8_t status;
+  bool dirPin = false;
+  int32_t position;
+  uint32_t reads[8];
+  uint32_t writes[8];
+};
@@ -0,0 +1,588 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDMotionPlanner.h
+///
+/// This file defines the HPSDMotionPlanner class, which computes the time
+/// between steps for moves with limited acceleration (and optionally jerk) so
+/// that a stepper motor can reach high speeds without stalling at the start or
+/// the end of a move.
+
+#pragma once
+
+#include <stdint.h>
+
+/// This class plans a move from rest to rest and then produces the interval
+/// before each step, one step at a time.
+///
+/// plan() does all of the work that needs square roots and searches, using
+/// only integer math.  nextInterval() is cheap enough to call from the step
+/// interrupt: it uses about one 32-bit integer division per step and no
+/// floating point at all (the Photon's Cortex-M3 has no FPU).
+///
+/// With a jerk of 0, the planner generates a trapezoidal profile using the
+/// recurrence from David Austin's "Generate stepper-motor speed profiles in
+/// real time" (also known as Atmel application note AVR446).  With a non-zero
+/// jerk, it generates an S-curve profile by evaluating the closed-form speed of
+/// a jerk-limited acceleration at the time of each step.  Along the way it
+/// records the speed in a small table every few steps, and it decelerates by
+/// replaying that table by remaining distance, so the end of the move mirrors
+/// the start exactly.
+///
+/// Speeds are in steps per second, accelerations in steps per second squared,
+/// and jerks in steps per second cubed.
+class HPSDMotionPlanner
+{
+public:
+  /// Plans a move of the specified number of steps.
+  ///
+  /// If the move is too short to reach @p maxSpeed, the planner lowers the peak
+  /// speed so that it can still stop at the end.
+  void plan(uint32_t steps, uint32_t maxSpeed, uint32_t accel, uint32_t jerk = 0)
+  {
+    if (maxSpeed == 0) { maxSpeed = 1; }
+    if (accel == 0) { accel = 1; }
+
+    totalSteps = steps;
+    stepCount = 0;
+    roundingQ8 = 128;
+    rampSteps = 0;
+    this->jerk = jerk;
+
+    if (jerk == 0)
+    {
+      planTrapezoid(maxSpeed, accel, 0, 0);
+    }
+    else
+    {
+      planSCurve(maxSpeed, accel, jerk);
+    }
+  }
+
+  /// Plans one segment of a continuous path: a trapezoidal move that starts
+  /// at @p entrySpeed, accelerates towards @p maxSpeed, and ends at
+  /// @p exitSpeed, all with acceleration @p accel.
+  ///
+  /// With both end speeds 0, this is the same as plan() with a jerk of 0.
+  /// The end speeds must be reachable: @p exitSpeed squared can be at most
+  /// @p entrySpeed squared plus 2 * @p accel * @p steps, and the other way
+  /// around.  HPSDMoveStream picks speeds that are.  S-curve profiles are not
+  /// supported for segments.
+  void planSegment(uint32_t steps, uint32_t entrySpeed, uint32_t maxSpeed, uint32_t exitSpeed,
+    uint32_t accel)
+  {
+    if (maxSpeed == 0) { maxSpeed = 1; }
+    if (accel == 0) { accel = 1; }
+    if (entrySpeed > maxSpeed) { entrySpeed = maxSpeed; }
+    if (exitSpeed > maxSpeed) { exitSpeed = maxSpeed; }
+
+    totalSteps = steps;
+    stepCount = 0;
+    roundingQ8 = 128;
+    rampSteps = 0;
+    jerk = 0;
+    planTrapezoid(maxSpeed, accel, entrySpeed, exitSpeed);
+  }
+
+  /// Plans a move of the specified number of steps at a constant step period,
+  /// with no acceleration.
+  void planConstant(uint32_t steps, uint32_t periodUs)
+  {
+    totalSteps = steps;
+    stepCount = 0;
+    roundingQ8 = 128;
+    jerk = 0;
+    decelSteps = 0;
+    intervalQ8 = clampInterval((uint64_t)periodUs << 8);
+    phase = Phase::Cruise;
+  }
+
+  /// Advances the planner by one step and returns the number of microseconds
+  /// from that step to the next one, or 0 if that was the last step of the
+  /// move.
+  ///
+  /// Call this once each time a step is taken.  It uses only integer math and
+  /// is safe to call from an interrupt.
+  uint32_t nextInterval()
+  {
+    if (stepCount >= totalSteps) { return 0; }
+    stepCount++;
+    if (stepCount >= totalSteps)
+    {
+      phase = Phase::Idle;
+      return 0;
+    }
+
+    // Carry the fraction of a microsecond that rounding leaves, so that the
+    // intervals add up to the planned time.
+    uint32_t next = (jerk == 0 ? nextTrapezoid() : nextSCurve()) + roundingQ8;
+    roundingQ8 = next & 0xFF;
+    return next >> 8;
+  }
+
+  /// Returns the most recent interval returned by nextInterval() (or the first
+  /// interval, before any steps), in microseconds.  After the last step, this
+  /// is the interval at the end speed of the move.
+  uint32_t getIntervalUs() const
+  {
+    return (intervalQ8 + 128) >> 8;
+  }
+
+  /// Returns true if there are no steps left in the planned move.
+  bool isDone() const
+  {
+    return stepCount >= totalSteps;
+  }
+
+  /// Returns the number of steps in the planned move that have not been taken.
+  uint32_t getStepsRemaining() const
+  {
+    return totalSteps - stepCount;
+  }
+
+  /// Returns the current planned speed in steps per second.
+  uint32_t getSpeed() const
+  {
+    return intervalQ8 ? (256000000u + intervalQ8 / 2) / intervalQ8 : 0;
+  }
+
+  /// Returns true while the planner is accelerating.
+  bool isAccelerating() const
+  {
+    return phase == Phase::Accel || phase == Phase::Jerk1 ||
+      phase == Phase::ConstAccel || phase == Phase::Jerk2;
+  }
+
+  /// Returns true while the planner is decelerating.
+  bool isDecelerating() const
+  {
+    return phase == Phase::Decel;
+  }
+
+  /// Returns true while the planner is moving at its peak speed.
+  bool isCruising() const
+  {
+    return phase == Phase::Cruise;
+  }
+
+  /// Returns the integer square root of a 64-bit number, rounded down.
+  static uint32_t isqrt(uint64_t x)
+  {
+    uint64_t result = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+    while (bit > x) { bit >>= 2; }
+    while (bit != 0)
+    {
+      if (x >= result + bit)
+      {
+        x -= result + bit;
+        result = (result >> 1) + bit;
+      }
+      else
+      {
+        result >>= 1;
+      }
+      bit >>= 2;
+    }
+    return (uint32_t)result;
+  }
+
+protected:
+
+  enum class Phase : uint8_t
+  {
+    Idle,
+
+    // Trapezoidal phases.
+    Accel,
+    Cruise,
+    Decel,
+
+    // S-curve acceleration phases.  Jerk1 raises the acceleration, ConstAccel
+    // holds it, and Jerk2 brings it back to zero.  S-curve profiles also use
+    // Cruise and Decel.
+    Jerk1,
+    ConstAccel,
+    Jerk2,
+  };
+
+  // Intervals are kept in units of 1/256 microsecond, and the remainder of
+  // each step of the recurrence is carried into the next, so that its
+  // rounding errors do not accumulate.  This limit (about 4 seconds) keeps
+  // 2 * interval plus a remainder within a uint32_t.
+  static const uint32_t MaxIntervalQ8 = 0x3FFFFFFF;
+
+  // 1/1000000 as a 32-bit fixed-point fraction, so that dividing by a million
+  // is a multiply and a shift.
+  static const uint32_t MicrosReciprocal = 4295;
+
+  /// Returns rate * dtUs / 1000000 without dividing.
+  static int32_t perMicros(int64_t rate, uint32_t dtUs)
+  {
+    return (int32_t)((rate * dtUs * MicrosReciprocal) >> 32);
+  }
+
+  static uint32_t clampInterval(uint64_t intervalQ8)
+  {
+    return intervalQ8 > MaxIntervalQ8 ? MaxIntervalQ8 : (uint32_t)intervalQ8;
+  }
+
+  /// Returns the number of steps needed to accelerate from rest to @p speed;
+  /// v^2 = 2 * a * n.
+  static uint32_t rampDistance(uint32_t speed, uint32_t accel)
+  {
+    return (uint32_t)(((uint64_t)speed * speed) / (2 * (uint64_t)accel));
+  }
+
+  void planTrapezoid(uint32_t maxSpeed, uint32_t accel, uint32_t entrySpeed, uint32_t exitSpeed)
+  {
+    minIntervalQ8 = clampInterval(((uint64_t)1000000 << 8) / maxSpeed);
+
+    // The ramp is indexed by the number of steps it would take to reach the
+    // current speed from rest, so a move that starts or ends moving picks up
+    // the recurrence part of the way along.
+    if (entrySpeed == 0)
+    {
+      // Equation 15 from Austin: c0 = 0.676 * f * sqrt(2 / a), and
+      // 0.676 * 1000000 * sqrt(2) = 956008.
+      intervalQ8 = clampInterval(((uint64_t)956008 << 16) / isqrt((uint64_t)accel << 16));
+      rampIndex = 0;
+    }
+    else
+    {
+      intervalQ8 = clampInterval(((uint64_t)1000000 << 8) / entrySpeed);
+      rampIndex = rampDistance(entrySpeed, accel);
+    }
+    exitRampSteps = rampDistance(exitSpeed, accel);
+    rampRemainder = 0;
+
+    uint32_t maxSpeedSteps = rampDistance(maxSpeed, accel);
+    if (maxSpeedSteps == 0) { maxSpeedSteps = 1; }
+
+    // The peak is where the acceleration and deceleration ramps meet, if that
+    // is below the maximum speed.
+    uint32_t rampTotal = totalSteps + rampIndex + exitRampSteps;
+    uint32_t accelLimit = rampTotal / 2;
+    uint32_t peakSteps = maxSpeedSteps < accelLimit ? maxSpeedSteps : rampTotal - accelLimit;
+    decelSteps = peakSteps > exitRampSteps ? peakSteps - exitRampSteps : 0;
+    if (decelSteps > totalSteps) { decelSteps = totalSteps; }
+
+    if (intervalQ8 <= minIntervalQ8)
+    {
+      // The move starts at (or above) the maximum speed, or the maximum speed
+      // is below the speed reached after one step, so there is no
+      // acceleration.  From rest, there is no deceleration either.
+      intervalQ8 = minIntervalQ8;
+      cruiseEntryQ8 = minIntervalQ8;
+      if (entrySpeed == 0) { decelSteps = 0; }
+      phase = Phase::Cruise;
+    }
+    else
+    {
+      phase = Phase::Accel;
+    }
+  }
+
+  uint32_t nextTrapezoid()
+  {
+    uint32_t remaining = totalSteps - stepCount;
+
+    switch (phase)
+    {
+    case Phase::Accel:
+      if (remaining <= decelSteps)
+      {
+        rampIndex = -(int32_t)(remaining + exitRampSteps);
+        rampRemainder = 0;
+        phase = Phase::Decel;
+        return intervalQ8;
+      }
+      {
+        // Return the current interval, then advance it for the next step.
+        uint32_t current = intervalQ8;
+        rampIndex++;
+        uint32_t numerator = 2 * intervalQ8 + rampRemainder;
+        uint32_t denominator = 4 * rampIndex + 1;
+        intervalQ8 -= numerator / denominator;
+        rampRemainder = numerator % denominator;
+        if (intervalQ8 <= minIntervalQ8)
+        {
+          cruiseEntryQ8 = intervalQ8;
+          intervalQ8 = minIntervalQ8;
+          phase = Phase::Cruise;
+        }
+        return current;
+      }
+
+    case Phase::Cruise:
+      if (remaining <= decelSteps)
+      {
+        rampIndex = -(int32_t)(remaining + exitRampSteps);
+        rampRemainder = 0;
+        intervalQ8 = decelSteps ? cruiseEntryQ8 : minIntervalQ8;
+        phase = Phase::Decel;
+      }
+      return intervalQ8;
+
+    case Phase::Decel:
+      // The same recurrence with a negative index makes the interval grow.
+      if (rampIndex < -1)
+      {
+        rampIndex++;
+        uint32_t numerator = 2 * intervalQ8 + rampRemainder;
+        uint32_t denominator = -(4 * rampIndex + 1);
+        intervalQ8 = clampInterval((uint64_t)intervalQ8 + numerator / denominator);
+        rampRemainder = numerator % denominator;
+      }
+      return intervalQ8;
+
+    default:
+      return intervalQ8;
+    }
+  }
+
+  /// Returns the number of steps needed to accelerate from rest to
+  /// @p speed with an S-curve profile.
+  static uint64_t sCurveDistance(uint64_t speed, uint64_t accel, uint64_t jerk)
+  {
+    if (speed * jerk <= accel * accel)
+    {
+      // The acceleration never reaches its limit: t = 2 * sqrt(v / j) and the
+      // average speed is v / 2.
+      return isqrt(speed * speed * speed / jerk);
+    }
+    // t = v / a + a / j.
+    return (speed * speed / accel + speed * accel / jerk) / 2;
+  }
+
+  void planSCurve(uint32_t maxSpeed, uint32_t accel, uint32_t jerk)
+  {
+    // Find the highest peak speed whose acceleration phase fits in half of the
+    // move, so the deceleration can mirror it.
+    uint32_t low = 0, high = maxSpeed;
+    while (low < high)
+    {
+      uint32_t mid = low + (high - low + 1) / 2;
+      if (sCurveDistance(mid, accel, jerk) <= totalSteps / 2) { low = mid; }
+      else { high = mid - 1; }
+    }
+    uint32_t peakSpeed = low ? low : 1;
+
+    // Phase durations in microseconds.  If the acceleration limit is reached,
+    // each jerk phase lasts a / j; otherwise the two jerk phases split the
+    // speed change evenly and last sqrt(v / j) each.
+    if ((uint64_t)peakSpeed * jerk <= (uint64_t)accel * accel)
+    {
+      jerkTimeUs = isqrt((uint64_t)peakSpeed * 1000000000000ull / jerk);
+      constTimeUs = 0;
+    }
+    else
+    {
+      jerkTimeUs = (uint32_t)((uint64_t)accel * 1000000 / jerk);
+      constTimeUs = (uint32_t)((uint64_t)peakSpeed * 1000000 / accel) - jerkTimeUs;
+    }
+    if (jerkTimeUs == 0) { jerkTimeUs = 1; }
+
+    // jerkSpeed(t) = j * t^2 / 2 in 1/256 steps per second, with t in
+    // microseconds, is jerkCoefficient * (t^2 / 256) / 2^32.
+    jerkCoefficient = (uint64_t)jerk * 140737;
+    jerkCoefficient /= 1000;
+    maxAccelQ8 = accel << 8;
+    jerkEndQ8 = jerkSpeed(jerkTimeUs);
+    peakSpeedQ8 = 2 * jerkEndQ8 + perMicros(maxAccelQ8, constTimeUs);
+
+    // Pick the spacing of the ramp table so that the whole acceleration fits.
+    uint32_t rampDistance = (uint32_t)sCurveDistance(peakSpeed, accel, jerk) + 1;
+    rampShift = 0;
+    while ((rampDistance >> rampShift) >= RampTableSize - 1) { rampShift++; }
+    rampEntries = 0;
+
+    // Under constant jerk from rest, s = j * t^3 / 6, so the first step takes
+    // t = cbrt(6 / j).
+    uint32_t lowTime = 1, highTime = 1 << 21;
+    uint64_t target = 6000000000000000000ull / jerk;
+    while (lowTime < highTime)
+    {
+      uint32_t mid = lowTime + (highTime - lowTime) / 2;
+      if ((uint64_t)mid * mid * mid < target) { lowTime = mid + 1; }
+      else { highTime = mid; }
+    }
+
+    elapsedUs = 0;
+    intervalQ8 = clampInterval((uint64_t)lowTime << 8);
+    speedQ8 = speedFromInterval(intervalQ8);
+    phase = Phase::Jerk1;
+  }
+
+  /// Returns j * t^2 / 2 in 1/256 steps per second.
+  uint32_t jerkSpeed(uint32_t t) const
+  {
+    return (uint32_t)((jerkCoefficient * (((uint64_t)t * t) >> 8)) >> 32);
+  }
+
+  uint32_t nextSCurve()
+  {
+    uint32_t remaining = totalSteps - stepCount;
+
+    // Start decelerating when as many steps are left as the acceleration took,
+    // even if a short move has not finished accelerating.
+    if (isAccelerating() && remaining <= stepCount)
+    {
+      rampSteps = stepCount - 1;
+      phase = Phase::Decel;
+    }
+    else if (phase == Phase::Cruise && remaining <= rampSteps)
+    {
+      phase = Phase::Decel;
+    }
+
+    if (phase == Phase::Decel)
+    {
+      intervalQ8 = intervalFromSpeed(rampSpeed(remaining - 1));
+      return intervalQ8;
+    }
+
+    if (phase == Phase::Cruise)
+    {
+      return intervalQ8;
+    }
+
+    // Accelerating: evaluate the speed at the time of this step from the
+    // closed-form profile, so no error accumulates from step to step.  The
+    // first step uses the interval computed by plan().
+    if (elapsedUs != 0)
+    {
+      uint32_t t = elapsedUs;
+      uint32_t constEnd = jerkTimeUs + constTimeUs;
+      uint32_t end = constEnd + jerkTimeUs;
+      if (t < jerkTimeUs)
+      {
+        phase = Phase::Jerk1;
+        speedQ8 = jerkSpeed(t);
+      }
+      else if (t < constEnd)
+      {
+        phase = Phase::ConstAccel;
+        speedQ8 = jerkEndQ8 + perMicros(maxAccelQ8, t - jerkTimeUs);
+      }
+      else if (t < end)
+      {
+        phase = Phase::Jerk2;
+        speedQ8 = peakSpeedQ8 - jerkSpeed(end - t);
+      }
+      else
+      {
+        speedQ8 = peakSpeedQ8;
+      }
+
+      if (speedQ8 < rampTable[0]) { speedQ8 = rampTable[0]; }
+      intervalQ8 = intervalFromSpeed(speedQ8);
+
+      if (t >= end)
+      {
+        rampSteps = stepCount;
+        phase = Phase::Cruise;
+      }
+    }
+
+    // Record the speed of every 2^rampShift-th interval so the deceleration
+    // can replay it by distance.
+    if (((stepCount - 1) & ((1 << rampShift) - 1)) == 0 && rampEntries < RampTableSize)
+    {
+      rampTable[rampEntries++] = speedQ8;
+    }
+    rampEndSpeedQ8 = speedQ8;
+
+    elapsedUs += (intervalQ8 + 128) >> 8;
+    return intervalQ8;
+  }
+
+  /// Returns the speed of the acceleration's interval number @p steps
+  /// (counting from 0), interpolated from the ramp table.
+  uint32_t rampSpeed(uint32_t steps) const
+  {
+    if (rampEntries == 0 || rampSteps == 0) { return speedQ8; }
+    if (steps >= rampSteps) { steps = rampSteps - 1; }
+
+    uint32_t index = steps >> rampShift;
+    uint32_t span = 1 << rampShift;
+    uint32_t from = rampTable[index < rampEntries ? index : rampEntries - 1];
+    uint32_t to;
+
+    if (index + 1 < rampEntries)
+    {
+      to = rampTable[index + 1];
+    }
+    else
+    {
+      // Between the last recorded entry and the end of the acceleration.
+      index = rampEntries - 1;
+      span = (rampSteps - 1) - (index << rampShift);
+      to = rampEndSpeedQ8;
+      if (span == 0) { return to; }
+    }
+
+    uint32_t offset = steps - (index << rampShift);
+    if (offset > span) { offset = span; }
+    int32_t delta = (int32_t)(to - from);
+    return from + (int32_t)(((int64_t)delta * offset) / (int32_t)span);
+  }
+
+  static uint32_t speedFromInterval(uint32_t intervalQ8)
+  {
+    // The same division as intervalFromSpeed(); it is its own inverse.
+    return intervalFromSpeed(intervalQ8);
+  }
+
+  static uint32_t intervalFromSpeed(uint32_t speedQ8)
+  {
+    // interval = 1000000 / v.  Dividing 1/16 microsecond units keeps this
+    // 32-bit divisions: 16000000 * 256 fits in a uint32_t.  The remainder
+    // then gives the last 4 bits, rounded, so that the interval is not up to
+    // 1/16 microsecond short (over 1% at 200000 steps per second).
+    if (speedQ8 >= (1u << 27)) { return clampInterval(65536000000ull / speedQ8); }
+    uint32_t quotient = 4096000000u / speedQ8;
+    uint32_t remainder = 4096000000u % speedQ8;
+    return clampInterval(((uint64_t)quotient << 4) + ((remainder << 4) + speedQ8 / 2) / speedQ8);
+  }
+
+  static const uint8_t RampTableSize = 32;
+
+  Phase phase = Phase::Idle;
+  uint32_t totalSteps = 0;
+  uint32_t stepCount = 0;
+  uint32_t jerk = 0;
+  uint32_t intervalQ8 = 0;
+
+  // The part of a microsecond that nextInterval() has not returned yet, plus
+  // 1/2 so that each interval is rounded to the nearest microsecond.
+  uint32_t roundingQ8 = 128;
+
+  // Trapezoidal state.
+  uint32_t minIntervalQ8 = 0;
+  uint32_t cruiseEntryQ8 = 0;
+  uint32_t decelSteps = 0;
+  uint32_t exitRampSteps = 0;
+  int32_t rampIndex = 0;
+
+  // What the recurrence's last division left over, carried into the next
+  // step as in AVR446, so that the small changes near the top speed are not
+  // rounded away.
+  uint32_t rampRemainder = 0;
+
+  // S-curve state.
+  uint32_t rampSteps = 0;
+  uint32_t speedQ8 = 0;
+  uint32_t peakSpeedQ8 = 0;
+  uint32_t jerkEndQ8 = 0;
+  uint32_t maxAccelQ8 = 0;
+  uint32_t rampEndSpeedQ8 = 0;
+  uint64_t jerkCoefficient = 0;
+  uint32_t jerkTimeUs = 0;
+  uint32_t constTimeUs = 0;
+  uint32_t elapsedUs = 0;
+
+  // Speeds recorded during the acceleration, one every 2^rampShift steps.
+  uint32_t rampTable[RampTableSize];
+  uint8_t rampEntries = 0;
+  uint8_t rampShift = 0;
+};
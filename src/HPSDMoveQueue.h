@@ -0,0 +1,196 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDMoveQueue.h
+///
+/// This file defines the HPSDMoveQueue class, a lock-free queue of planned
+/// moves that the application fills and the step interrupt drains.
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include "HPSDMotionPlanner.h"
+
+/// One move in an HPSDMoveQueue.
+///
+/// The move is planned when it is pushed, so the step interrupt only has to
+/// take the next segment off the queue and start stepping.
+struct HPSDMoveSegment
+{
+  /// The number of steps in the move.
+  uint32_t steps;
+
+  /// True if the move goes in the reverse direction (negative steps).
+  bool reverse;
+
+  /// The planned step timing.
+  HPSDMotionPlanner planner;
+};
+
+/// This class is the part of HPSDMoveQueue that does not depend on its
+/// capacity.  HPSDStepEngine::setQueue() takes a pointer to it.
+///
+/// The queue is safe for exactly one producer (usually the application
+/// thread; Particle.function() handlers also run there) and one consumer (the
+/// step interrupt) without disabling interrupts or taking locks: each side
+/// only writes its own index, and the indices are published with
+/// release/acquire ordering.
+class HPSDMoveQueueBase
+{
+public:
+  /// Plans a move and adds it to the end of the queue.
+  ///
+  /// The arguments have the same meaning as in HPSDMotionPlanner::plan(),
+  /// except that a negative @p steps means the reverse direction.
+  ///
+  /// Planning happens here, on the producer's thread, so this can take longer
+  /// than popping a segment does.
+  ///
+  /// @return false if the queue is full.
+  bool push(int32_t steps, uint32_t maxSpeed, uint32_t accel, uint32_t jerk = 0)
+  {
+    HPSDMoveSegment * segment = reserve(steps);
+    if (segment == nullptr) { return false; }
+    segment->planner.plan(segment->steps, maxSpeed, accel, jerk);
+    publish();
+    return true;
+  }
+
+  /// Plans a segment that starts and ends moving (see
+  /// HPSDMotionPlanner::planSegment()) and adds it to the end of the queue.
+  /// A negative @p steps means the reverse direction.
+  ///
+  /// @return false if the queue is full.
+  bool pushSegment(int32_t steps, uint32_t entrySpeed, uint32_t maxSpeed, uint32_t exitSpeed,
+    uint32_t accel)
+  {
+    HPSDMoveSegment * segment = reserve(steps);
+    if (segment == nullptr) { return false; }
+    segment->planner.planSegment(segment->steps, entrySpeed, maxSpeed, exitSpeed, accel);
+    publish();
+    return true;
+  }
+
+  /// Adds a constant-speed move with the specified step period to the end of
+  /// the queue.
+  ///
+  /// @return false if the queue is full.
+  bool pushConstant(int32_t steps, uint32_t periodUs)
+  {
+    HPSDMoveSegment * segment = reserve(steps);
+    if (segment == nullptr) { return false; }
+    segment->planner.planConstant(segment->steps, periodUs);
+    publish();
+    return true;
+  }
+
+  /// Returns the segment at the front of the queue, or null if the queue is
+  /// empty.
+  ///
+  /// Only the consumer may call this.  The segment stays valid until
+  /// release() is called.
+  HPSDMoveSegment * front()
+  {
+    uint16_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) { return nullptr; }
+    return &slots[t & mask];
+  }
+
+  /// Removes the segment at the front of the queue.  Only the consumer may
+  /// call this.
+  void release()
+  {
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  /// Removes every segment from the queue.  Only the consumer may call this.
+  void clear()
+  {
+    tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+  }
+
+  /// Returns the number of segments in the queue, including the one being
+  /// executed.
+  uint16_t size() const
+  {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+
+  /// Returns true if no more segments can be pushed.
+  bool isFull() const
+  {
+    return size() > mask;
+  }
+
+  /// Returns true if the queue has no segments.
+  bool isEmpty() const
+  {
+    return size() == 0;
+  }
+
+protected:
+
+  HPSDMoveQueueBase(HPSDMoveSegment * slots, uint16_t capacity)
+    : slots(slots), mask(capacity - 1), head(0), tail(0)
+  {
+  }
+
+  HPSDMoveSegment * reserve(int32_t steps)
+  {
+    uint16_t h = head.load(std::memory_order_relaxed);
+    if ((uint16_t)(h - tail.load(std::memory_order_acquire)) > mask) { return nullptr; }
+    HPSDMoveSegment * segment = &slots[h & mask];
+    segment->reverse = steps < 0;
+    segment->steps = steps < 0 ? -steps : steps;
+    return segment;
+  }
+
+  void publish()
+  {
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  HPSDMoveSegment * const slots;
+  const uint16_t mask;
+
+  // Free-running counters; the slot index is the counter modulo the capacity.
+  std::atomic<uint16_t> head;
+  std::atomic<uint16_t> tail;
+};
+
+/// A lock-free single-producer, single-consumer queue of up to @p Capacity
+/// planned moves, allocated statically.  @p Capacity must be a power of two.
+///
+/// Example usage:
+/// ~~~{.cpp}
+/// HPSDMoveQueue<8> moves;
+///
+/// void setup()
+/// {
+///   engine.begin(StepPin, DirPin);
+///   engine.setQueue(&moves);
+/// }
+///
+/// void loop()
+/// {
+///   if (!moves.isFull())
+///   {
+///     moves.push(1600, 4000, 8000);
+///     moves.push(-1600, 4000, 8000);
+///     engine.startQueue();
+///   }
+/// }
+/// ~~~
+template <uint16_t Capacity> class HPSDMoveQueue : public HPSDMoveQueueBase
+{
+  static_assert(Capacity >= 2 && Capacity <= 0x8000 && (Capacity & (Capacity - 1)) == 0,
+    "HPSDMoveQueue capacity must be a power of two.");
+
+public:
+  HPSDMoveQueue() : HPSDMoveQueueBase(storage, Capacity)
+  {
+  }
+
+private:
+  HPSDMoveSegment storage[Capacity];
+};
@@ -0,0 +1,394 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDMoveStream.h
+///
+/// This file defines the HPSDMoveStream class, which reads move commands from
+/// a Serial port or network connection and feeds them to an HPSDStepEngine's
+/// queue without stopping between moves.
+
+#pragma once
+
+#include <Arduino.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "HPSDStepEngine.h"
+#include "HPSDMoveQueue.h"
+
+/// This class streams moves from a host into an HPSDMoveQueue, planning the
+/// speed at each junction between moves so that a continuous path runs
+/// without decelerating to a stop at the end of every move.
+///
+/// ## Commands
+///
+/// The host sends one command per line.  Numbers are decimal integers; the
+/// speed and acceleration are optional, and default to the values set with
+/// setDefaults() or the F and A commands.
+///
+/// Command                         | Meaning
+/// ------------------------------- | -------------------------------------------
+/// `M <steps> [<speed> [<accel>]]` | Move by @p steps (negative for reverse).
+/// `T <position> [<speed> [<accel>]]` | Move to an absolute position.
+/// `F <speed>`                     | Set the default maximum speed (steps/s).
+/// `A <accel>`                     | Set the default acceleration (steps/s²).
+/// `S`                             | Stop immediately and discard every move.
+/// `?`                             | Report the position and buffered moves.
+///
+/// The reply to `?` is the position, the planned end position, and the
+/// numbers of buffered and queued moves, separated by spaces.
+///
+/// Each command is answered with `ok` once it has been accepted, or with a
+/// line starting with `error`.  While the lookahead buffer is full, no more
+/// input is read, so the Serial or TCP buffers hold it back; a host can keep
+/// several commands in flight instead of waiting for each move to finish, so
+/// the round trip is not between the moves.
+///
+/// ## Planning
+///
+/// Received moves wait in a lookahead buffer of @p Lookahead moves.  A move is
+/// planned and pushed onto the engine's queue when the queue is down to its
+/// last segment (or the buffer is full).  Its exit speed is the highest one
+/// from which every buffered move after it could still come to a stop by the
+/// end of the buffer, limited at each junction: consecutive moves in the same
+/// direction can keep the lower of their maximum speeds, and a reversal has
+/// to stop.  The segments are trapezoidal (see
+/// HPSDMotionPlanner::planSegment()).  When the engine is idle, the first
+/// move waits up to the start delay for more moves to arrive, so it has
+/// something to plan ahead with.
+///
+/// Example usage:
+/// ~~~{.cpp}
+/// HPSDMoveQueue<4> moves;
+/// HPSDMoveStream<16> commands;
+///
+/// void setup()
+/// {
+///   Serial.begin(115200);
+///   engine.begin(sd);
+///   commands.begin(Serial, engine, moves);
+///   commands.setDefaults(4000, 20000);
+/// }
+///
+/// void loop()
+/// {
+///   commands.service();
+/// }
+/// ~~~
+///
+/// To take commands over the network instead, pass a connected `TCPClient`
+/// to setStream().
+template <uint8_t Lookahead> class HPSDMoveStream
+{
+  static_assert(Lookahead >= 2 && Lookahead <= 128, "HPSDMoveStream lookahead must be 2 to 128 moves.");
+
+public:
+  /// The longest command line that is accepted, including the line ending.
+  static const uint8_t LineSize = 48;
+
+  /// Sets the stream to read commands from and the engine and queue to run
+  /// the moves with.  This calls HPSDStepEngine::setQueue().
+  void begin(Stream & stream, HPSDStepEngine & engine, HPSDMoveQueueBase & queue)
+  {
+    this->engine = &engine;
+    this->queue = &queue;
+    engine.setQueue(&queue);
+    setStream(stream);
+    stop();
+  }
+
+  /// Changes the stream that commands are read from, for example when a new
+  /// TCP client connects.  A partly received line is discarded.
+  void setStream(Stream & stream)
+  {
+    this->stream = &stream;
+    lineLength = 0;
+    lineOverflow = false;
+  }
+
+  /// Sets the speed (in steps per second) and acceleration (in steps per
+  /// second squared) used by moves that do not specify them.
+  void setDefaults(uint32_t maxSpeed, uint32_t accel)
+  {
+    if (maxSpeed) { defaultSpeed = maxSpeed; }
+    if (accel) { defaultAccel = accel; }
+  }
+
+  /// Sets how long the first move waits for more moves when the engine is
+  /// idle, in milliseconds.  The default is 50 ms.
+  void setStartDelay(uint32_t ms)
+  {
+    startDelayMs = ms;
+  }
+
+  /// Adds a move to the lookahead buffer, as the M command does.
+  ///
+  /// @return false if the buffer is full.
+  bool add(int32_t steps, uint32_t maxSpeed, uint32_t accel)
+  {
+    if (count >= Lookahead) { return false; }
+    syncPosition();
+    lastInputMs = millis();
+    if (steps == 0) { return true; }
+
+    Move & move = moves[(head + count) % Lookahead];
+    move.steps = HPSDStepEngine::distance(steps);
+    move.reverse = steps < 0;
+    move.maxSpeed = maxSpeed ? maxSpeed : 1;
+    move.accel = accel ? accel : 1;
+    count++;
+    plannedPosition = (int32_t)((uint32_t)plannedPosition + (uint32_t)steps);
+    return true;
+  }
+
+  /// Reads any commands that have arrived and keeps the engine's queue
+  /// supplied.  Call this as often as possible from your main loop.
+  void service()
+  {
+    if (engine == nullptr) { return; }
+    readCommands();
+    commitMoves();
+  }
+
+  /// Stops the engine immediately and discards every buffered and queued
+  /// move.
+  void stop()
+  {
+    if (engine == nullptr) { return; }
+    engine->stop();
+    count = 0;
+    entrySpeed = 0;
+    plannedPosition = engine->getPosition();
+  }
+
+  /// Returns the number of moves in the lookahead buffer.
+  uint8_t getBufferedCount() const
+  {
+    return count;
+  }
+
+  /// Returns the position the engine will reach after every buffered and
+  /// queued move.
+  int32_t getPlannedPosition() const
+  {
+    return plannedPosition;
+  }
+
+protected:
+
+  struct Move
+  {
+    uint32_t steps;
+    bool reverse;
+    uint32_t maxSpeed;
+    uint32_t accel;
+  };
+
+  /// The number of queued segments, including the one being executed, below
+  /// which another move is planned.
+  static const uint8_t QueueAhead = 2;
+
+  const Move & at(uint8_t index) const
+  {
+    return moves[(head + index) % Lookahead];
+  }
+
+  /// When nothing is buffered or moving, the engine may have been moved by
+  /// other code, so take its position as the start of the path.
+  void syncPosition()
+  {
+    if (count == 0 && !engine->isRunning()) { plannedPosition = engine->getPosition(); }
+  }
+
+  void readCommands()
+  {
+    if (stream == nullptr) { return; }
+
+    while (stream->available() > 0)
+    {
+      // Leave the rest of the input in the stream while the buffer is full.
+      if (lineLength == 0 && count >= Lookahead) { return; }
+
+      int c = stream->read();
+      if (c < 0) { return; }
+
+      if (c == '\n' || c == '\r')
+      {
+        if (lineOverflow)
+        {
+          stream->println("error: line too long");
+        }
+        else if (lineLength != 0)
+        {
+          line[lineLength] = 0;
+          handleLine();
+        }
+        lineLength = 0;
+        lineOverflow = false;
+      }
+      else if (lineLength < LineSize - 1)
+      {
+        line[lineLength++] = (char)c;
+      }
+      else
+      {
+        lineOverflow = true;
+      }
+    }
+  }
+
+  void handleLine()
+  {
+    const char * p = line;
+    while (*p == ' ') { p++; }
+    if (*p == 0) { return; }
+    char command = toupper(*p++);
+    if (strchr("MTFAS?", command) == nullptr)
+    {
+      stream->println("error: bad command");
+      return;
+    }
+
+    long args[3];
+    uint8_t argCount = 0;
+    while (true)
+    {
+      char * end;
+      long value = strtol(p, &end, 10);
+      if (end == p) { break; }
+      if (argCount < 3) { args[argCount] = value; }
+      argCount++;
+      p = end;
+    }
+    while (*p == ' ') { p++; }
+    if (*p != 0 || argCount > 3)
+    {
+      stream->println("error: bad arguments");
+      return;
+    }
+
+    uint32_t speed = argCount >= 2 && args[1] > 0 ? args[1] : defaultSpeed;
+    uint32_t accel = argCount >= 3 && args[2] > 0 ? args[2] : defaultAccel;
+
+    switch (command)
+    {
+    case 'M':
+      if (argCount < 1) { break; }
+      add(args[0], speed, accel);
+      stream->println("ok");
+      return;
+
+    case 'T':
+      if (argCount < 1) { break; }
+      syncPosition();
+      add((int32_t)((uint32_t)args[0] - (uint32_t)plannedPosition), speed, accel);
+      stream->println("ok");
+      return;
+
+    case 'F':
+      if (argCount != 1 || args[0] <= 0) { break; }
+      defaultSpeed = args[0];
+      stream->println("ok");
+      return;
+
+    case 'A':
+      if (argCount != 1 || args[0] <= 0) { break; }
+      defaultAccel = args[0];
+      stream->println("ok");
+      return;
+
+    case 'S':
+      stop();
+      stream->println("ok");
+      return;
+
+    case '?':
+      stream->printlnf("%ld %ld %u %u", (long)engine->getPosition(), (long)plannedPosition,
+        (unsigned)count, (unsigned)queue->size());
+      stream->println("ok");
+      return;
+    }
+
+    stream->println("error: bad arguments");
+  }
+
+  void commitMoves()
+  {
+    while (count > 0 && !queue->isFull())
+    {
+      if (!engine->isRunning())
+      {
+        // Nothing is moving, so the next segment starts from rest.  Give the
+        // host a moment to send the moves after it.
+        entrySpeed = 0;
+        if (count < Lookahead && millis() - lastInputMs < startDelayMs) { return; }
+      }
+      else if (queue->size() >= QueueAhead && count < Lookahead)
+      {
+        // Enough is queued; keep gathering moves to plan with.
+        return;
+      }
+
+      commitNext();
+      engine->startQueue();
+    }
+  }
+
+  /// Returns the square of the highest speed at which the path can go from
+  /// @p from into @p to.
+  static uint64_t junctionSpeedSq(const Move & from, const Move & to)
+  {
+    if (from.reverse != to.reverse) { return 0; }
+    uint64_t speed = from.maxSpeed < to.maxSpeed ? from.maxSpeed : to.maxSpeed;
+    return speed * speed;
+  }
+
+  /// Plans the oldest buffered move and pushes it onto the engine's queue.
+  void commitNext()
+  {
+    // Work backwards from a stop at the end of the buffer to find the fastest
+    // speed the oldest move can end at.  Speeds are squared so that each
+    // limit is a sum: v_entry^2 = v_exit^2 + 2 * a * d.
+    uint64_t exitSq = 0;
+    for (uint8_t i = count - 1; i > 0; i--)
+    {
+      const Move & next = at(i);
+      uint64_t entrySq = exitSq + 2 * (uint64_t)next.accel * next.steps;
+      uint64_t junctionSq = junctionSpeedSq(at(i - 1), next);
+      exitSq = entrySq < junctionSq ? entrySq : junctionSq;
+    }
+
+    // It also cannot end faster than it can accelerate to.
+    const Move & move = at(0);
+    uint64_t reachSq = (uint64_t)entrySpeed * entrySpeed + 2 * (uint64_t)move.accel * move.steps;
+    if (exitSq > reachSq) { exitSq = reachSq; }
+
+    uint32_t exitSpeed = HPSDMotionPlanner::isqrt(exitSq);
+    queue->pushSegment(move.reverse ? -(int32_t)move.steps : (int32_t)move.steps,
+      entrySpeed, move.maxSpeed, exitSpeed, move.accel);
+    entrySpeed = exitSpeed;
+
+    head = (head + 1) % Lookahead;
+    count--;
+  }
+
+  Stream * stream = nullptr;
+  HPSDStepEngine * engine = nullptr;
+  HPSDMoveQueueBase * queue = nullptr;
+
+  Move moves[Lookahead];
+  uint8_t head = 0;
+  uint8_t count = 0;
+
+  // The speed at which the last pushed segment ends.
+  uint32_t entrySpeed = 0;
+  int32_t plannedPosition = 0;
+
+  uint32_t defaultSpeed = 1000;
+  uint32_t defaultAccel = 1000;
+  uint32_t startDelayMs = 50;
+  uint32_t lastInputMs = 0;
+
+  char line[LineSize];
+  uint8_t lineLength = 0;
+  bool lineOverflow = false;
+};
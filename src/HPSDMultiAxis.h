@@ -0,0 +1,229 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDMultiAxis.h
+///
+/// This file defines the HPSDMultiAxis class, which steps several High-Power
+/// Stepper Motor Drivers together from a single hardware timer so that
+/// coordinated moves stay in sync.
+
+#pragma once
+
+#include <Arduino.h>
+#include "HighPowerStepperDriver.h"
+#include "HPSDStepTimer.h"
+#include "HPSDMotionPlanner.h"
+
+/// This class moves up to @p MaxAxes drivers along a straight line in step
+/// space.
+///
+/// A move is planned for the axis with the most steps (the dominant axis),
+/// using HPSDMotionPlanner.  On each of its steps, the timer interrupt runs
+/// one iteration of Bresenham's line algorithm for every other axis and raises
+/// the STEP pins of all the axes that need to step together, so all of the
+/// axes start and finish at the same time and no axis needs its own timer.
+///
+/// Positive step counts move an axis in its default direction (RDIR = 0);
+/// negative step counts move it the other way.  Directions are set over SPI
+/// with HighPowerStepperDriver::setDirection() before the move starts.
+///
+/// Example usage:
+/// ~~~{.cpp}
+/// HPSDMultiAxis<3> axes;
+///
+/// void setup()
+/// {
+///   axes.addAxis(sdX, StepPinX);
+///   axes.addAxis(sdY, StepPinY);
+///   axes.addAxis(sdZ, StepPinZ);
+///   axes.begin();
+/// }
+///
+/// void loop()
+/// {
+///   if (!axes.isRunning())
+///   {
+///     const int32_t steps[] = { 3200, -1600, 400 };
+///     axes.move(steps, 8000, 20000);
+///   }
+/// }
+/// ~~~
+template <uint8_t MaxAxes> class HPSDMultiAxis
+{
+  static_assert(MaxAxes >= 1 && MaxAxes <= 32, "HPSDMultiAxis supports 1 to 32 axes.");
+
+public:
+  /// The width of each STEP pulse.  See HPSDStepEngine::StepPulseUs.
+  static const uint32_t StepPulseUs = 3;
+
+  /// The shortest step period the controller will generate.
+  static const uint32_t MinStepPeriodUs = 2 * StepPulseUs;
+
+  /// Adds a driver to the controller and configures its STEP pin.
+  ///
+  /// @return The index of the new axis, or -1 if there are already
+  /// @p MaxAxes axes.
+  int8_t addAxis(HighPowerStepperDriver & sd, uint8_t stepPin)
+  {
+    if (axisCount >= MaxAxes) { return -1; }
+    Axis & axis = axes[axisCount];
+    axis.driver = &sd;
+    axis.stepPin = stepPin;
+    pinMode(stepPin, OUTPUT);
+    pinResetFast(stepPin);
+    return axisCount++;
+  }
+
+  /// Claims the hardware timer used to step all of the axes.
+  ///
+  /// @return true on success, false if no hardware timer was available (see
+  /// #HPSD_STEP_TIMER_COUNT).
+  bool begin()
+  {
+    return timer.begin(onTimer, this);
+  }
+
+  /// Returns the number of axes added with addAxis().
+  uint8_t getAxisCount() const
+  {
+    return axisCount;
+  }
+
+  /// Starts a coordinated move.
+  ///
+  /// @p steps must have one entry per axis, in the order the axes were added.
+  /// @p maxSpeed, @p accel, and @p jerk apply to the dominant axis and have the
+  /// same meaning as in HPSDMotionPlanner::plan(); the other axes move
+  /// proportionally slower.
+  ///
+  /// This function returns immediately and replaces any move in progress.
+  void move(const int32_t * steps, uint32_t maxSpeed, uint32_t accel, uint32_t jerk = 0)
+  {
+    stop();
+
+    uint32_t dominant = 0;
+    for (uint8_t i = 0; i < axisCount; i++)
+    {
+      Axis & axis = axes[i];
+      axis.delta = steps[i] < 0 ? -steps[i] : steps[i];
+      if (axis.delta) { axis.driver->setDirection(steps[i] < 0); }
+      if (axis.delta > dominant) { dominant = axis.delta; }
+    }
+
+    // Start every error term at half the dominant count so that the minor
+    // axes' steps are centered rather than bunched at the end.
+    for (uint8_t i = 0; i < axisCount; i++)
+    {
+      axes[i].error = dominant / 2;
+    }
+
+    dominantSteps = dominant;
+    stepsRemaining = dominant;
+    planner.plan(dominant, maxSpeed, accel, jerk);
+
+    if (dominant)
+    {
+      timer.start(HPSDStepTimer::MinDelayUs);
+    }
+  }
+
+  /// Stops all axes immediately.  Steps not yet taken are discarded.
+  ///
+  /// It is safe to call this from an interrupt.
+  void stop()
+  {
+    timer.stop();
+    lowerPins();
+    stepsRemaining = 0;
+  }
+
+  /// Returns true if a move is in progress.
+  bool isRunning() const
+  {
+    return timer.isRunning();
+  }
+
+  /// Returns the number of dominant-axis steps left in the current move.
+  uint32_t getStepsRemaining() const
+  {
+    return stepsRemaining;
+  }
+
+  /// This object plans the dominant axis of each move.
+  HPSDMotionPlanner planner;
+
+  /// This object is the hardware timer used by the controller.
+  HPSDStepTimer timer;
+
+protected:
+
+  struct Axis
+  {
+    HighPowerStepperDriver * driver;
+    uint8_t stepPin;
+    uint32_t delta;
+    uint32_t error;
+  };
+
+  static uint32_t onTimer(void * context)
+  {
+    return ((HPSDMultiAxis *)context)->tick();
+  }
+
+  void lowerPins()
+  {
+    for (uint8_t i = 0; i < axisCount; i++)
+    {
+      if (pulseMask & (1u << i)) { pinResetFast(axes[i].stepPin); }
+    }
+    pulseMask = 0;
+  }
+
+  /// Called from the timer interrupt.  Like HPSDStepEngine, each step takes
+  /// one tick to raise the STEP pins and one to lower them.
+  uint32_t tick()
+  {
+    if (pulseMask)
+    {
+      lowerPins();
+      if (currentPeriodUs == 0) { return 0; }
+      return currentPeriodUs - StepPulseUs;
+    }
+
+    if (stepsRemaining == 0) { return 0; }
+
+    uint32_t mask = 0;
+    for (uint8_t i = 0; i < axisCount; i++)
+    {
+      Axis & axis = axes[i];
+      axis.error += axis.delta;
+      if (axis.error >= dominantSteps)
+      {
+        axis.error -= dominantSteps;
+        pinSetFast(axis.stepPin);
+        mask |= 1u << i;
+      }
+    }
+    // The dominant axis steps every time, so the mask is never empty.
+    pulseMask = mask;
+
+    stepsRemaining--;
+    if (stepsRemaining == 0)
+    {
+      currentPeriodUs = 0;
+    }
+    else
+    {
+      currentPeriodUs = planner.nextInterval();
+      if (currentPeriodUs < MinStepPeriodUs) { currentPeriodUs = MinStepPeriodUs; }
+    }
+
+    return StepPulseUs;
+  }
+
+  Axis axes[MaxAxes];
+  uint8_t axisCount = 0;
+  uint32_t dominantSteps = 0;
+  volatile uint32_t stepsRemaining = 0;
+  volatile uint32_t pulseMask = 0;
+  uint32_t currentPeriodUs = 0;
+};
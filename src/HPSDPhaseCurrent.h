@@ -0,0 +1,123 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDPhaseCurrent.h
+///
+/// This file defines the HPSDPhaseCurrent class, which changes a driver's
+/// current limit to match what an HPSDStepEngine is doing.
+
+#pragma once
+
+#include <Arduino.h>
+#include "HighPowerStepperDriver.h"
+#include "HPSDStepEngine.h"
+
+/// This class switches a driver between three current limits depending on
+/// the motion of its HPSDStepEngine:
+///
+/// - the boost current while the engine is accelerating or decelerating,
+/// - the run current while it is cruising or has only just stopped, and
+/// - the hold current once it has been stopped for the hold delay.
+///
+/// All three levels share the ISGAIN needed by the highest of them, so the
+/// TORQUE values are computed once in begin() and each switch is a single
+/// TORQUE register write.
+///
+/// The step interrupt cannot use SPI, so the switching happens in service(),
+/// which you should call often from your main loop.  A switch therefore lags
+/// a change of phase by up to one pass through the loop.
+///
+/// Example usage:
+/// ~~~{.cpp}
+/// HPSDPhaseCurrent current;
+///
+/// void setup()
+/// {
+///   // 2.5 A on the ramps, 1.5 A cruising, 0.5 A after 500 ms at rest.
+///   current.begin<HPSD36v4>(sd, engine, 2500, 1500, 500, 500);
+/// }
+///
+/// void loop()
+/// {
+///   current.service();
+/// }
+/// ~~~
+class HPSDPhaseCurrent
+{
+public:
+  /// The current levels.
+  enum class Level : uint8_t
+  {
+    Hold,
+    Run,
+    Boost,
+  };
+
+  /// Computes the TORQUE values for the three current levels (in milliamps)
+  /// on the board described by @p Board, sets ISGAIN, and selects the run
+  /// current.
+  ///
+  /// @p holdDelayMs is how long the engine has to be stopped before the hold
+  /// current is selected.
+  template <class Board> void begin(HighPowerStepperDriver & sd, HPSDStepEngine & engine,
+    uint16_t boostCurrent, uint16_t runCurrent, uint16_t holdCurrent, uint32_t holdDelayMs)
+  {
+    this->sd = &sd;
+    this->engine = &engine;
+    this->holdDelayMs = holdDelayMs;
+
+    uint16_t highest = boostCurrent;
+    if (runCurrent > highest) { highest = runCurrent; }
+    if (holdCurrent > highest) { highest = holdCurrent; }
+
+    uint8_t isgain = Board::isgainBits(highest);
+    torqueBits[(uint8_t)Level::Hold]  = Board::torqueBitsAtGain(holdCurrent, isgain);
+    torqueBits[(uint8_t)Level::Run]   = Board::torqueBitsAtGain(runCurrent, isgain);
+    torqueBits[(uint8_t)Level::Boost] = Board::torqueBitsAtGain(boostCurrent, isgain);
+
+    sd.beginUpdate();
+    sd.setCurrentMilliamps<Board>(highest);
+    sd.setTorque(torqueBits[(uint8_t)Level::Run]);
+    sd.commit();
+
+    level = Level::Run;
+    stoppedSince = millis();
+  }
+
+  /// Selects the current level for what the engine is doing, writing TORQUE
+  /// if it changed.  Call this from your main loop, not from an interrupt.
+  void service()
+  {
+    if (sd == nullptr) { return; }
+
+    Level wanted;
+    if (engine->isRunning())
+    {
+      wanted = engine->isRamping() ? Level::Boost : Level::Run;
+      stoppedSince = millis();
+    }
+    else
+    {
+      wanted = (millis() - stoppedSince >= holdDelayMs) ? Level::Hold : Level::Run;
+    }
+
+    if (wanted != level)
+    {
+      level = wanted;
+      sd->setTorque(torqueBits[(uint8_t)level]);
+    }
+  }
+
+  /// Returns the current level selected by the last call to service().
+  Level getLevel() const
+  {
+    return level;
+  }
+
+protected:
+  HighPowerStepperDriver * sd = nullptr;
+  HPSDStepEngine * engine = nullptr;
+  uint8_t torqueBits[3];
+  Level level = Level::Run;
+  uint32_t holdDelayMs = 0;
+  uint32_t stoppedSince = 0;
+};
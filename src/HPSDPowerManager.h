@@ -0,0 +1,255 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDPowerManager.h
+///
+/// This file defines the HPSDPowerManager class, which lowers a driver's power
+/// use while its HPSDStepEngine is idle and wakes it for the next move.
+
+#pragma once
+
+#include <Arduino.h>
+#include "HighPowerStepperDriver.h"
+#include "HPSDStepEngine.h"
+
+/// This class puts an idle axis into lower-power states in two stages:
+///
+/// 1. **Holding:** after the engine has been stopped for the hold delay,
+///    TORQUE is lowered to the hold current (one register write), so the motor
+///    keeps its position with less current.
+/// 2. **Asleep:** after the sleep delay, the DRV8711's SLEEPn pin is driven
+///    low, which turns off the H-bridges and the charge pump.  The motor is no
+///    longer held.
+///
+/// While the driver is asleep, the engine's queue is held (see
+/// HPSDStepEngine::setQueueHold()), so a move pushed with
+/// HPSDMoveQueue::push() and HPSDStepEngine::startQueue() waits instead of
+/// sending steps the driver would ignore.  service() notices the waiting
+/// move, drives SLEEPn high, and after the wake time writes every setting
+/// (with the run current) in one batched SPI transaction and releases the
+/// queue in the same call, so the first step follows as soon as the driver
+/// can take it.  The time from the held startQueue() call (or from wake())
+/// to the release is measured; see getLastWakeLatency().
+///
+/// The whole latency is the wake time plus up to one pass through your main
+/// loop.  If you know a move is coming, such as when a command arrives, call
+/// wake() right away so that the wake time overlaps with preparing the move.
+///
+/// The settings are written when waking because writes made while the
+/// driver is asleep might not reach it.  Moves started with
+/// HPSDStepEngine::run() or move() are not held back; call wake() and wait
+/// for isAwake() before starting them.  Do not use this class together with
+/// HPSDPhaseCurrent, since both set TORQUE while the engine is idle.
+///
+/// Example usage:
+/// ~~~{.cpp}
+/// HPSDPowerManager power;
+///
+/// void setup()
+/// {
+///   // 0.4 A after 200 ms at rest, and sleep after 30 s at rest.
+///   power.begin<HPSD36v4>(sd, engine, SleepPin, 400, 200, 30000);
+/// }
+///
+/// void loop()
+/// {
+///   power.service();
+/// }
+/// ~~~
+class HPSDPowerManager
+{
+public:
+  /// The power states.
+  enum class State : uint8_t
+  {
+    Active,
+    Holding,
+    Asleep,
+    Waking,
+  };
+
+  /// Sets up power management for a driver and its engine.
+  ///
+  /// @p sleepPin is the pin connected to SLEEPn, or #HPSD_NO_PIN if it is not
+  /// connected, in which case the driver never sleeps.  It is driven high
+  /// here.  The hold TORQUE value is computed for @p holdCurrent milliamps on
+  /// the board described by @p Board with the ISGAIN the driver has now.
+  /// @p sleepDelayMs is measured from when the engine stopped, like
+  /// @p holdDelayMs; 0 means never sleep.
+  template <class Board> void begin(HighPowerStepperDriver & sd, HPSDStepEngine & engine,
+    uint8_t sleepPin, uint16_t holdCurrent, uint32_t holdDelayMs, uint32_t sleepDelayMs)
+  {
+    this->sd = &sd;
+    this->engine = &engine;
+    this->sleepPin = sleepPin;
+    this->holdDelayMs = holdDelayMs;
+    this->sleepDelayMs = sleepDelayMs;
+    holdTorque = Board::torqueBitsAtGain(holdCurrent, sd.getGain());
+    runTorque = sd.getTorque();
+
+    if (sleepPin != HPSD_NO_PIN)
+    {
+      pinMode(sleepPin, OUTPUT);
+      pinSetFast(sleepPin);
+    }
+
+    engine.setQueueHold(false);
+    state = State::Active;
+    idleSince = millis();
+  }
+
+  /// Sets how long the driver needs after SLEEPn goes high before it can
+  /// take steps, in microseconds.  The default is 1000, the DRV8711's
+  /// maximum wake time.
+  void setWakeTime(uint32_t us)
+  {
+    wakeUs = us;
+  }
+
+  /// Starts waking the driver if it is asleep, and resets the idle timer so
+  /// that it stays awake for another sleep delay.  This does not block; the
+  /// driver is ready once isAwake() returns true.
+  void wake()
+  {
+    if (sd == nullptr) { return; }
+    idleSince = millis();
+    if (state == State::Asleep) { startWake(micros()); }
+  }
+
+  /// Returns true unless the driver is asleep or waking up.
+  bool isAwake() const
+  {
+    return state == State::Active || state == State::Holding;
+  }
+
+  /// Moves between the power states.  Call this as often as possible from
+  /// your main loop, not from an interrupt.
+  void service()
+  {
+    if (sd == nullptr) { return; }
+
+    switch (state)
+    {
+    case State::Active:
+    case State::Holding:
+      if (engine->isRunning())
+      {
+        idleSince = millis();
+        if (state == State::Holding)
+        {
+          sd->setTorque(runTorque);
+          state = State::Active;
+        }
+      }
+      else if (state == State::Active)
+      {
+        if (millis() - idleSince >= holdDelayMs)
+        {
+          // Keep whatever run current the application has set since.
+          runTorque = sd->getTorque();
+          sd->setTorque(holdTorque);
+          state = State::Holding;
+        }
+      }
+      else if (sleepPin != HPSD_NO_PIN && sleepDelayMs != 0 &&
+        millis() - idleSince >= sleepDelayMs)
+      {
+        sleep();
+      }
+      break;
+
+    case State::Asleep:
+      if (engine->isQueueStartPending()) { startWake(engine->getQueueStartRequestTime()); }
+      break;
+
+    case State::Waking:
+      if (micros() - wakeStartUs >= wakeUs) { finishWake(); }
+      break;
+    }
+  }
+
+  /// Returns the current power state.
+  State getState() const
+  {
+    return state;
+  }
+
+  /// Returns the time from the last wake request (a held startQueue() call or
+  /// wake()) to the queue being released, in microseconds.
+  uint32_t getLastWakeLatency() const
+  {
+    return lastLatencyUs;
+  }
+
+  /// Returns the longest wake latency so far, in microseconds.
+  uint32_t getMaxWakeLatency() const
+  {
+    return maxLatencyUs;
+  }
+
+  /// Returns the number of times the driver has been woken.
+  uint32_t getWakeCount() const
+  {
+    return wakeCount;
+  }
+
+protected:
+
+  void sleep()
+  {
+    // Hold the queue first, so that a move started from now on waits for
+    // the wake, then check that none was started before.
+    engine->setQueueHold(true);
+    if (engine->isRunning())
+    {
+      engine->setQueueHold(false);
+      return;
+    }
+
+    pinResetFast(sleepPin);
+    state = State::Asleep;
+  }
+
+  void startWake(uint32_t requestUs)
+  {
+    pinSetFast(sleepPin);
+    wakeRequestUs = requestUs;
+    wakeStartUs = micros();
+    state = State::Waking;
+  }
+
+  void finishWake()
+  {
+    // Put the run current back in the cache and write all of the settings in
+    // one transaction.
+    sd->beginUpdate();
+    sd->setTorque(runTorque);
+    sd->applySettings();
+    sd->commit();
+
+    engine->setQueueHold(false);
+    lastLatencyUs = micros() - wakeRequestUs;
+    if (lastLatencyUs > maxLatencyUs) { maxLatencyUs = lastLatencyUs; }
+    wakeCount++;
+
+    idleSince = millis();
+    state = State::Active;
+  }
+
+  HighPowerStepperDriver * sd = nullptr;
+  HPSDStepEngine * engine = nullptr;
+  uint8_t sleepPin = HPSD_NO_PIN;
+  State state = State::Active;
+
+  uint8_t holdTorque = 0;
+  uint8_t runTorque = 0;
+  uint32_t holdDelayMs = 0;
+  uint32_t sleepDelayMs = 0;
+  uint32_t idleSince = 0;
+
+  uint32_t wakeUs = 1000;
+  uint32_t wakeRequestUs = 0;
+  uint32_t wakeStartUs = 0;
+  uint32_t lastLatencyUs = 0;
+  uint32_t maxLatencyUs = 0;
+  uint32_t wakeCount = 0;
+};
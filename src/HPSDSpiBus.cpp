@@ -0,0 +1,89 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+#include "HPSDSpiBus.h"
+
+void DRV8711SPI::lockBus()
+{
+#ifdef HPSD_SPI_STATS
+  if (!bus->tryLock())
+  {
+    uint32_t start = System.ticks();
+    bus->lock();
+    stats.busWaits.record(System.ticks() - start);
+  }
+#else
+  bus->lock();
+#endif
+}
+
+void DRV8711SPI::unlockBus()
+{
+  bus->unlock();
+}
+
+void HPSDSpiBus::detach(DRV8711SPI & device)
+{
+  lock();
+  uint8_t kept = 0;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if (frames[i].device != &device) { frames[kept++] = frames[i]; }
+  }
+  count = kept;
+  device.setBus(nullptr);
+  unlock();
+}
+
+bool HPSDSpiBus::queue(DRV8711SPI & device, uint16_t value, volatile uint16_t * result, HPSDBusPriority priority)
+{
+  lock();
+  bool queued = count < HPSD_BUS_QUEUE_SIZE;
+  if (queued)
+  {
+    Frame & frame = frames[count++];
+    frame.device = &device;
+    frame.result = result;
+    frame.value = value;
+    frame.priority = priority;
+  }
+  unlock();
+  return queued;
+}
+
+uint8_t HPSDSpiBus::flush()
+{
+  lock();
+  uint8_t sent = count;
+  DRV8711SPI * current = nullptr;
+
+  for (uint8_t priority = (uint8_t)HPSDBusPriority::High; priority <= (uint8_t)HPSDBusPriority::Low; priority++)
+  {
+    for (uint8_t i = 0; i < count; i++)
+    {
+      Frame & frame = frames[i];
+      if ((uint8_t)frame.priority != priority) { continue; }
+
+      DRV8711SPI & device = *frame.device;
+      if (current == nullptr || current->clockSpeed != device.clockSpeed)
+      {
+        // Only a change of clock speed needs a new transaction; the drivers
+        // otherwise share the same SPI mode and bit order.
+        if (current != nullptr) { SPI.endTransaction(); }
+        DRV8711SPI::finishAllAsync();
+        SPI.beginTransaction(device.settings);
+      }
+      current = &device;
+
+      uint16_t value = device.transferFrame(frame.value);
+      if (frame.result != nullptr)
+      {
+        *frame.result = value & 0xFFF;
+      }
+    }
+  }
+
+  if (current != nullptr) { SPI.endTransaction(); }
+  count = 0;
+  unlock();
+  return sent;
+}
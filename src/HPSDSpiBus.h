@@ -0,0 +1,151 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDSpiBus.h
+///
+/// This file defines the HPSDSpiBus class, which arbitrates access to an SPI
+/// bus shared by several DRV8711 drivers and sends their queued register
+/// frames back to back.
+
+#pragma once
+
+#include <Arduino.h>
+#include "concurrent_hal.h"
+#include "HighPowerStepperDriver.h"
+
+/// The number of frames that can be waiting in an HPSDSpiBus queue.
+#define HPSD_BUS_QUEUE_SIZE 32
+
+/// Priorities for frames queued with HPSDSpiBus.  When the queue is flushed,
+/// all High frames are sent first, then Normal, then Low; frames with the same
+/// priority are sent in the order they were queued.
+enum class HPSDBusPriority : uint8_t
+{
+  /// Frames that affect motion, such as steps, direction, and enable.
+  High = 0,
+
+  /// Ordinary setting changes.
+  Normal = 1,
+
+  /// Diagnostic reads, such as STATUS polling.
+  Low = 2,
+};
+
+/// This class manages an SPI bus shared by several DRV8711SPI objects, each
+/// with its own chip select pin.
+///
+/// It does two things:
+///
+/// - It serializes access.  Once a DRV8711SPI object is attached, every
+///   blocking transfer it makes (readReg(), writeReg(), writeRegs()) holds
+///   this object's recursive mutex for the duration of the transaction, so
+///   threads talking to different drivers cannot interleave frames.
+///
+/// - It batches.  queueWrite() and queueRead() add frames for any attached
+///   driver to a shared queue, and flush() sends all of them in one SPI
+///   transaction (reconfiguring the bus only between drivers with different
+///   clock speeds), in priority order.
+///
+/// Asynchronous DMA transfers (DRV8711SPI::writeRegAsync()) bypass the queue;
+/// they are serialized by the SPI transaction they hold instead.
+///
+/// Example usage:
+/// ~~~{.cpp}
+/// HPSDSpiBus bus;
+///
+/// void setup()
+/// {
+///   bus.attach(sdX.driver);
+///   bus.attach(sdY.driver);
+/// }
+///
+/// void loop()
+/// {
+///   bus.queueWrite(sdX.driver, HPSDRegAddr::CTRL, ctrlX, HPSDBusPriority::High);
+///   bus.queueRead(sdY.driver, HPSDRegAddr::STATUS, &statusY);
+///   bus.flush();
+/// }
+/// ~~~
+class HPSDSpiBus
+{
+public:
+  /// Attaches a driver to this bus.  See DRV8711SPI::setBus().
+  void attach(DRV8711SPI & device)
+  {
+    if (mutex == nullptr)
+    {
+      os_mutex_recursive_create(&mutex);
+    }
+    device.setBus(this);
+  }
+
+  /// Detaches a driver from this bus.  Any of its frames that are still
+  /// queued are discarded.
+  void detach(DRV8711SPI & device);
+
+  /// Queues a register write.
+  ///
+  /// @return false if the queue is full (see #HPSD_BUS_QUEUE_SIZE).
+  bool queueWrite(DRV8711SPI & device, HPSDRegAddr address, uint16_t value,
+    HPSDBusPriority priority = HPSDBusPriority::Normal)
+  {
+    return queue(device, (((uint8_t)address & 0b111) << 12) | (value & 0xFFF), nullptr, priority);
+  }
+
+  /// Queues a register read.  The register's value is stored in @p result by
+  /// flush().
+  ///
+  /// @return false if the queue is full (see #HPSD_BUS_QUEUE_SIZE).
+  bool queueRead(DRV8711SPI & device, HPSDRegAddr address, volatile uint16_t * result,
+    HPSDBusPriority priority = HPSDBusPriority::Low)
+  {
+    return queue(device, (0x8 | ((uint8_t)address & 0b111)) << 12, result, priority);
+  }
+
+  /// Sends every queued frame, highest priority first, in a single SPI
+  /// transaction unless drivers with different clock speeds are involved.
+  ///
+  /// @return The number of frames sent.
+  uint8_t flush();
+
+  /// Returns the number of frames waiting to be sent.
+  uint8_t getPendingCount() const
+  {
+    return count;
+  }
+
+  /// Acquires the bus.  Calls can be nested within one thread.
+  void lock()
+  {
+    if (mutex != nullptr) { os_mutex_recursive_lock(mutex); }
+  }
+
+  /// Acquires the bus lock if no other thread holds it.
+  ///
+  /// @return true if the lock was acquired; call unlock() to release it.
+  bool tryLock()
+  {
+    return mutex == nullptr || os_mutex_recursive_trylock(mutex) == 0;
+  }
+
+  /// Releases the bus.
+  void unlock()
+  {
+    if (mutex != nullptr) { os_mutex_recursive_unlock(mutex); }
+  }
+
+private:
+
+  struct Frame
+  {
+    DRV8711SPI * device;
+    volatile uint16_t * result;
+    uint16_t value;
+    HPSDBusPriority priority;
+  };
+
+  bool queue(DRV8711SPI & device, uint16_t value, volatile uint16_t * result, HPSDBusPriority priority);
+
+  os_mutex_recursive_t mutex = nullptr;
+  Frame frames[HPSD_BUS_QUEUE_SIZE];
+  uint8_t count = 0;
+};
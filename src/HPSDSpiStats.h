@@ -0,0 +1,141 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDSpiStats.h
+///
+/// This file defines the HPSDSpiStats structure, which DRV8711SPI fills with
+/// counts and timings of its SPI transactions when the library is compiled
+/// with HPSD_SPI_STATS defined.
+
+#pragma once
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+
+/// SPI transaction statistics for one DRV8711SPI object.
+///
+/// These are only collected if HPSD_SPI_STATS is defined for the whole build,
+/// including the library's .cpp files (for example with
+/// `EXTRA_CFLAGS += -DHPSD_SPI_STATS`), since it changes the layout of
+/// DRV8711SPI.  Without it, none of the instrumentation is compiled in.
+///
+/// Durations are measured with the CPU cycle counter (System.ticks()), so
+/// recording one costs only a couple of register reads.
+///
+/// Example usage:
+/// ~~~{.cpp}
+/// char json[HPSDSpiStats::FormatSize];
+/// sd.getSpiStats().format(json, sizeof(json));
+/// Particle.publish("spiStats", json);
+/// sd.getSpiStats().reset();
+/// ~~~
+struct HPSDSpiStats
+{
+  /// A count of operations with their total and longest duration.
+  struct Counter
+  {
+    uint32_t count;
+    uint64_t totalTicks;
+    uint32_t maxTicks;
+
+    void record(uint32_t ticks)
+    {
+      count++;
+      totalTicks += ticks;
+      if (ticks > maxTicks) { maxTicks = ticks; }
+    }
+  };
+
+  /// readReg() calls, by register address.
+  Counter reads[8];
+
+  /// writeReg() calls, by register address.  writeRegs() frames are counted
+  /// here with no duration; the duration of the whole batch is in batches.
+  Counter writes[8];
+
+  /// writeRegs() calls, which applySettings(), commit(), and every setter use.
+  Counter batches;
+
+  /// Times that a transfer had to wait because another thread held the
+  /// HPSDSpiBus lock, and how long it waited.
+  Counter busWaits;
+
+  /// The number of times HighPowerStepperDriver::applySettings() was called.
+  uint32_t applySettingsCount;
+
+  /// The size of a buffer that format() never truncates: every number it
+  /// writes has at most 10 digits, which makes 681 characters and the null.
+  static constexpr size_t FormatSize = 682;
+
+  HPSDSpiStats()
+  {
+    reset();
+  }
+
+  /// Clears all of the statistics.
+  void reset()
+  {
+    memset(this, 0, sizeof(*this));
+  }
+
+  /// Writes the statistics to @p buffer as a compact JSON object, with
+  /// durations in microseconds, short enough for Particle.publish().
+  /// Durations too long to fit in 32 bits are written as 4294967295.
+  ///
+  /// The output is truncated if @p size is less than #FormatSize, which
+  /// might only happen once the counts get large.
+  ///
+  /// The keys are r/w (per-register read and write counts, CTRL first),
+  /// rt/wt (total microseconds), rm/wm (longest microseconds), b/bt/bm (write
+  /// batches), bw/bwt/bwm (bus waits), and a (applySettings() calls).
+  ///
+  /// @return The length of the string that was written, as snprintf() does.
+  int format(char * buffer, size_t size) const
+  {
+    int n = snprintf(buffer, size, "{");
+    n += formatCounters(buffer, size, n, "r", reads);
+    n += formatCounters(buffer, size, n, "w", writes);
+    n += append(buffer, size, n, "\"b\":%lu,\"bt\":%lu,\"bm\":%lu,"
+      "\"bw\":%lu,\"bwt\":%lu,\"bwm\":%lu,\"a\":%lu}",
+      (unsigned long)batches.count, ticksToMicros(batches.totalTicks), ticksToMicros(batches.maxTicks),
+      (unsigned long)busWaits.count, ticksToMicros(busWaits.totalTicks), ticksToMicros(busWaits.maxTicks),
+      (unsigned long)applySettingsCount);
+    return n;
+  }
+
+private:
+  static unsigned long ticksToMicros(uint64_t ticks)
+  {
+    uint64_t us = ticks / System.ticksPerMicrosecond();
+    return us > 0xFFFFFFFF ? 0xFFFFFFFF : (unsigned long)us;
+  }
+
+  template <typename... Args>
+  static int append(char * buffer, size_t size, int used, const char * format, Args... args)
+  {
+    size_t offset = (size_t)used < size ? used : size;
+    return snprintf(buffer + offset, size - offset, format, args...);
+  }
+
+  static int formatCounters(char * buffer, size_t size, int used, const char * key, const Counter * counters)
+  {
+    int n = 0;
+    n += append(buffer, size, used + n, "\"%s\":[", key);
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      n += append(buffer, size, used + n, i ? ",%lu" : "%lu", (unsigned long)counters[i].count);
+    }
+    n += append(buffer, size, used + n, "],\"%st\":[", key);
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      n += append(buffer, size, used + n, i ? ",%lu" : "%lu", ticksToMicros(counters[i].totalTicks));
+    }
+    n += append(buffer, size, used + n, "],\"%sm\":[", key);
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      n += append(buffer, size, used + n, i ? ",%lu" : "%lu", ticksToMicros(counters[i].maxTicks));
+    }
+    n += append(buffer, size, used + n, "],");
+    return n;
+  }
+};
@@ -0,0 +1,806 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDStepEngine.h
+///
+/// This file defines the HPSDStepEngine class, which generates step pulses on
+/// a High-Power Stepper Motor Driver's STEP pin from a hardware timer
+/// interrupt so that your application does not have to spend its time in
+/// delayMicroseconds().
+
+#pragma once
+
+#include <Arduino.h>
+#include "HPSDStepTimer.h"
+#include "HPSDMotionPlanner.h"
+#include "HPSDMoveQueue.h"
+#include "HighPowerStepperDriver.h"
+
+/// A function called from the timer interrupt when the engine finishes its
+/// last move.
+typedef void (*HPSDMoveCompleteCallback)(void * context);
+
+/// This class generates STEP pulses for one driver from a hardware timer
+/// interrupt.
+///
+/// Each step is a high pulse of StepPulseUs microseconds on the STEP pin.  The
+/// rising edges are spaced by the requested step period with 1 microsecond
+/// resolution, and since the timer measures each period from the previous
+/// edge, interrupt latency does not make the stepping rate drift.
+///
+/// Moves can be started one at a time with run() or move(), or fed through an
+/// HPSDMoveQueue (see setQueue()), in which case the interrupt starts each
+/// queued move as soon as the previous one finishes.
+///
+/// The engine also keeps a 32-bit absolute position, counted on every step,
+/// and moveTo() and moveBy() plan moves in terms of it.  Positive steps are
+/// the driver's default direction (DIR low and RDIR = 0).
+///
+/// Example usage:
+/// ~~~{.cpp}
+/// HPSDStepEngine engine;
+///
+/// void setup()
+/// {
+///   engine.begin(StepPin);
+///   engine.setDriver(&sd);
+///   engine.setMotionLimits(4000, 8000);
+/// }
+///
+/// void loop()
+/// {
+///   if (!engine.isMoving())
+///   {
+///     engine.moveTo(engine.getPosition() == 0 ? 1000 : 0);
+///   }
+///
+///   // Other work can go here while the motor moves.
+/// }
+/// ~~~
+class HPSDStepEngine
+{
+public:
+  /// The width of each STEP pulse.  The DRV8711 requires the STEP pin to stay
+  /// high and low for at least 1.9 microseconds each; the extra margin covers
+  /// variation in interrupt latency.
+  static const uint32_t StepPulseUs = 3;
+
+  /// The shortest step period the engine will generate.
+  static const uint32_t MinStepPeriodUs = 2 * StepPulseUs;
+
+  /// Configures the STEP pin (and the DIR pin, if connected) and claims a
+  /// hardware timer.
+  ///
+  /// The DIR pin is only needed for queued moves that change direction, since
+  /// the timer interrupt cannot change the direction over SPI.  The DRV8711
+  /// XORs the DIR pin with the RDIR bit of its CTRL register.
+  ///
+  /// @return true on success, false if no hardware timer was available (see
+  /// #HPSD_STEP_TIMER_COUNT).
+  bool begin(uint8_t stepPin, uint8_t dirPin = HPSD_NO_PIN)
+  {
+    this->stepPin = stepPin;
+    pinMode(stepPin, OUTPUT);
+    pinResetFast(stepPin);
+
+    this->dirPin = dirPin;
+    reverse = false;
+    if (dirPin != HPSD_NO_PIN)
+    {
+      pinMode(dirPin, OUTPUT);
+      pinResetFast(dirPin);
+    }
+
+    return timer.begin(onTimer, this);
+  }
+
+  /// Uses the STEP and DIR pins set with
+  /// HighPowerStepperDriver::setStepDirPins(), and the driver itself for
+  /// setting the direction over SPI if there is no DIR pin.  See
+  /// begin(uint8_t, uint8_t).
+  bool begin(HighPowerStepperDriver & sd)
+  {
+    bool result = begin(sd.getStepPin(), sd.getDirPin());
+    setDriver(&sd);
+    return result;
+  }
+
+  /// Starts taking the specified number of steps with the specified period
+  /// between rising edges on the STEP pin.
+  ///
+  /// This function returns immediately.  Use isRunning() to find out when the
+  /// steps are done.  If the engine is already running, the new move replaces
+  /// the current one.
+  ///
+  /// The direction is not changed; set it with
+  /// HighPowerStepperDriver::setDirection() (or the DIR pin) before calling
+  /// this.
+  void run(uint32_t steps, uint32_t periodUs)
+  {
+    stop();
+    if (periodUs < MinStepPeriodUs) { periodUs = MinStepPeriodUs; }
+    stepPeriodUs = periodUs;
+    activePlanner = nullptr;
+    startSteps(steps);
+  }
+
+  /// Starts taking @p steps steps at a constant period, like run(), but in
+  /// the direction given by the sign of @p steps and counted in the position
+  /// like moveBy().
+  void runBy(int32_t steps, uint32_t periodUs)
+  {
+    stop();
+    setDirection(steps < 0);
+    run(distance(steps), periodUs);
+  }
+
+  /// Starts a move of the specified number of steps that accelerates to
+  /// @p maxSpeed (in steps per second) and decelerates to a stop at the end.
+  ///
+  /// @p accel is in steps per second squared.  If @p jerk (in steps per second
+  /// cubed) is non-zero, the move uses an S-curve profile instead of a
+  /// trapezoidal one.  See HPSDMotionPlanner for details.
+  ///
+  /// Like run(), this function returns immediately and replaces any move that
+  /// is in progress.
+  void move(uint32_t steps, uint32_t maxSpeed, uint32_t accel, uint32_t jerk = 0)
+  {
+    stop();
+    planner.plan(steps, maxSpeed, accel, jerk);
+    activePlanner = &planner;
+    startSteps(steps);
+  }
+
+  /// Sets the driver whose direction the engine sets over SPI for moveBy()
+  /// and moveTo() when there is no DIR pin.
+  void setDriver(HighPowerStepperDriver * sd)
+  {
+    this->sd = sd;
+    if (sd != nullptr && dirPin == HPSD_NO_PIN) { reverse = sd->getDirection(); }
+  }
+
+  /// Sets the speed, acceleration, and jerk used by the versions of moveBy()
+  /// and moveTo() that do not take them.  See move().
+  void setMotionLimits(uint32_t maxSpeed, uint32_t accel, uint32_t jerk = 0)
+  {
+    limitSpeed = maxSpeed;
+    limitAccel = accel;
+    limitJerk = jerk;
+  }
+
+  /// Starts a move of @p steps steps relative to the current position;
+  /// negative values move in the reverse direction.
+  ///
+  /// The direction is set with the DIR pin if there is one (see begin()), or
+  /// over SPI with the driver given to setDriver().  Like move(), this
+  /// returns immediately and replaces any move in progress.
+  void moveBy(int32_t steps, uint32_t maxSpeed, uint32_t accel, uint32_t jerk = 0)
+  {
+    stop();
+    setDirection(steps < 0);
+    move(distance(steps), maxSpeed, accel, jerk);
+  }
+
+  /// Starts a move of @p steps steps relative to the current position using
+  /// the limits from setMotionLimits().
+  void moveBy(int32_t steps)
+  {
+    moveBy(steps, limitSpeed, limitAccel, limitJerk);
+  }
+
+  /// Starts a move to the absolute position @p target.  See moveBy().
+  ///
+  /// If a move is in progress, it is stopped first, and the new move starts
+  /// from wherever that left the motor.
+  void moveTo(int32_t target, uint32_t maxSpeed, uint32_t accel, uint32_t jerk = 0)
+  {
+    stop();
+    moveBy((int32_t)((uint32_t)target - (uint32_t)position), maxSpeed, accel, jerk);
+  }
+
+  /// Starts a move to the absolute position @p target using the limits from
+  /// setMotionLimits().
+  void moveTo(int32_t target)
+  {
+    moveTo(target, limitSpeed, limitAccel, limitJerk);
+  }
+
+  /// Sets the direction for the next move started with run() or move(): with
+  /// the DIR pin if there is one, or else over SPI with the driver given to
+  /// setDriver().  The position counts down while @p reverse is true.
+  ///
+  /// Only call this while the engine is stopped.  moveBy(), moveTo(), and
+  /// runBy() call it for you.
+  void setDirection(bool reverse)
+  {
+    if (dirPin != HPSD_NO_PIN)
+    {
+      if (reverse) { pinSetFast(dirPin); } else { pinResetFast(dirPin); }
+    }
+    else if (sd != nullptr && sd->getDirection() != reverse)
+    {
+      sd->setDirection(reverse);
+    }
+    this->reverse = reverse;
+  }
+
+  /// Returns the absolute position in steps.
+  ///
+  /// moveBy(), moveTo(), and queued moves keep track of the direction; for
+  /// run() and move(), the position counts in the direction last set by the
+  /// engine, so change the direction with setDirection() rather than
+  /// HighPowerStepperDriver::setDirection() if you need the position.
+  int32_t getPosition() const
+  {
+    return position;
+  }
+
+  /// Sets the absolute position, for example to 0 after homing.
+  void setPosition(int32_t position)
+  {
+    ATOMIC_BLOCK()
+    {
+      this->position = position;
+    }
+  }
+
+  /// Returns true if a move is in progress.  This is the same as isRunning().
+  bool isMoving() const
+  {
+    return isRunning();
+  }
+
+  /// Sets a function to call when the engine takes the last step of its last
+  /// move (but not when it is stopped with stop()), or null for none.
+  ///
+  /// The function runs in the timer interrupt, so it must be short and must
+  /// not use SPI.
+  void setMoveCompleteCallback(HPSDMoveCompleteCallback callback, void * context = nullptr)
+  {
+    ATOMIC_BLOCK()
+    {
+      moveCompleteCallback = callback;
+      moveCompleteContext = context;
+    }
+  }
+
+  /// Sets the queue that the engine takes moves from, or null to stop using a
+  /// queue.
+  ///
+  /// Whenever a move finishes, the timer interrupt takes the next segment
+  /// from the queue and starts it right away.  After pushing segments, call
+  /// startQueue() to get the engine going if it has stopped.
+  void setQueue(HPSDMoveQueueBase * queue)
+  {
+    stop();
+    this->queue = queue;
+  }
+
+  /// Starts executing queued moves if the engine is idle and the queue is not
+  /// empty.  It does nothing if the engine is already running, since the
+  /// interrupt will get to the new segments on its own.
+  void startQueue()
+  {
+    if (queue == nullptr) { return; }
+
+    // The interrupt stops the timer after it finds the queue empty, so with
+    // interrupts disabled, either the timer is still running and will see the
+    // new segments or it has stopped and needs to be restarted.
+    ATOMIC_BLOCK()
+    {
+      if (queueHeld)
+      {
+        if (!queueStartPending && !timer.isRunning() && queue->front() != nullptr)
+        {
+          queueStartPending = true;
+          queueStartRequestUs = micros();
+        }
+      }
+      else if (!timer.isRunning() && queue->front() != nullptr)
+      {
+        activeSegment = nullptr;
+        segmentGapUs = 0;
+        pinResetFast(stepPin);
+        state = TickState::StepLow;
+        timer.start(startNextSegment());
+      }
+    }
+  }
+
+  /// Holds back queued moves, or lets them go again.
+  ///
+  /// While the queue is held, startQueue() does not start the engine; it only
+  /// records that it was asked to (see isQueueStartPending()).  Releasing the
+  /// hold starts the queue if a start was held back.  HPSDPowerManager uses
+  /// this to wake a sleeping driver before the first step of a move.  It does
+  /// not affect a move that is already running, or moves started with run()
+  /// or move().
+  void setQueueHold(bool hold)
+  {
+    bool start;
+    ATOMIC_BLOCK()
+    {
+      queueHeld = hold;
+      start = !hold && queueStartPending;
+      if (!hold) { queueStartPending = false; }
+    }
+    if (start) { startQueue(); }
+  }
+
+  /// Returns true if startQueue() was called while the queue was held and the
+  /// moves are waiting for setQueueHold(false).
+  bool isQueueStartPending() const
+  {
+    return queueStartPending;
+  }
+
+  /// Returns the micros() time of the first startQueue() call that was held
+  /// back, if isQueueStartPending() is true.
+  uint32_t getQueueStartRequestTime() const
+  {
+    return queueStartRequestUs;
+  }
+
+  /// Changes the period of a move started with run() that is in progress.  The
+  /// new period takes effect at the next step.
+  void setStepPeriod(uint32_t periodUs)
+  {
+    if (periodUs < MinStepPeriodUs) { periodUs = MinStepPeriodUs; }
+    stepPeriodUs = periodUs;
+  }
+
+  /// Stops stepping immediately.  Any steps that have not been taken, and any
+  /// segments left in the queue, are discarded.
+  ///
+  /// It is safe to call this from an interrupt.
+  void stop()
+  {
+    timer.stop();
+    pinResetFast(stepPin);
+    state = TickState::Idle;
+    stepsRemaining = 0;
+    segmentGapUs = 0;
+
+    // With the timer stopped, this is the consumer side of the queue.
+    if (queue != nullptr) { queue->clear(); }
+    activeSegment = nullptr;
+    queueStartPending = false;
+
+    // A MODE write in progress still finishes; see endStepScaleWrite().
+    if (scaleWindow != ScaleWindow::Writing) { scaleWindow = ScaleWindow::None; }
+  }
+
+  /// Returns true if the engine still has steps to take.
+  bool isRunning() const
+  {
+    return timer.isRunning();
+  }
+
+  /// Returns the number of steps left in the current move.
+  uint32_t getStepsRemaining() const
+  {
+    return stepsRemaining;
+  }
+
+  /// Returns the current step rate in steps per second, or 0 if the engine is
+  /// not running.
+  uint32_t getSpeed() const
+  {
+    if (!isRunning()) { return 0; }
+    HPSDMotionPlanner * p = activePlanner;
+    if (p != nullptr) { return p->getSpeed(); }
+    return 1000000 / stepPeriodUs;
+  }
+
+  /// Returns the STEP pin passed to begin().
+  uint8_t getStepPin() const
+  {
+    return stepPin;
+  }
+
+  /// Returns the direction set by setDirection() or the current move.
+  bool getDirection() const
+  {
+    return reverse;
+  }
+
+  /// Returns true if the engine is running a planned move (from move() or a
+  /// queue) and is accelerating or decelerating.
+  bool isRamping() const
+  {
+    if (!isRunning()) { return false; }
+    HPSDMotionPlanner * p = activePlanner;
+    return p != nullptr && (p->isAccelerating() || p->isDecelerating());
+  }
+
+  /// Sets the number of position counts each STEP pulse moves, for when the
+  /// driver is in a coarser step mode than the one positions are counted in.
+  /// Only call this while the engine is stopped; HPSDStepModeSwitcher calls
+  /// it for you.
+  ///
+  /// Steps, positions, speeds, and accelerations are always in the finer
+  /// unit.  With a scale of 8 (for example 1/4 step in a 1/32 step system),
+  /// each pulse adds 8 to the position and uses up 8 steps of the move, and
+  /// the period before it is the sum of the next 8 intervals of the move's
+  /// planner, so ramps keep their shape.
+  void setStepScale(uint8_t scale)
+  {
+    ATOMIC_BLOCK()
+    {
+      stepScale = scale ? scale : 1;
+      requestedScale = stepScale;
+      scaleWindow = ScaleWindow::None;
+    }
+  }
+
+  /// Returns the number of position counts each STEP pulse moves.
+  uint8_t getStepScale() const
+  {
+    return stepScale;
+  }
+
+  /// Sets a position at which the driver's indexer is at a full step (for
+  /// example, its home state right after a reset).  A coarser scale is only
+  /// switched to at positions that differ from this by a multiple of the
+  /// scale, where the indexer is at a valid state in both step modes.
+  void setPhaseOrigin(int32_t position)
+  {
+    phaseOrigin = position;
+  }
+
+  /// Asks the engine to change the step scale (a power of two) while moving.
+  ///
+  /// The timer interrupt cannot write MODE over SPI, so the switch is a
+  /// handshake with the application: at the next step after which the new
+  /// scale is valid, the engine makes the following period one fine
+  /// interval long and opens a window (see isStepScaleWindowOpen()).  If
+  /// MODE is written in that window, the next pulse uses the new scale;
+  /// otherwise the engine keeps going with the old one and tries again at the
+  /// next valid position.  Stepping only waits, if at all, while the MODE
+  /// frame itself is being sent.
+  ///
+  /// The engine also switches back to a scale of 1 on its own when fewer
+  /// steps are left in a move than a coarse pulse would take; that switch
+  /// waits as long as it has to.
+  void requestStepScale(uint8_t scale)
+  {
+    requestedScale = scale ? scale : 1;
+  }
+
+  /// Returns true if the engine is waiting for MODE to be written for
+  /// getStepScaleWindowTarget().
+  bool isStepScaleWindowOpen() const
+  {
+    return scaleWindow == ScaleWindow::Open;
+  }
+
+  /// Returns the scale that the open window switches to.
+  uint8_t getStepScaleWindowTarget() const
+  {
+    return windowScale;
+  }
+
+  /// Claims the open window before writing MODE.  Returns false if the
+  /// window has already closed, in which case MODE must not be written.
+  /// While the window is claimed, the next pulse waits for
+  /// endStepScaleWrite().
+  bool beginStepScaleWrite()
+  {
+    bool claimed = false;
+    ATOMIC_BLOCK()
+    {
+      if (scaleWindow == ScaleWindow::Open)
+      {
+        scaleWindow = ScaleWindow::Writing;
+        claimed = true;
+      }
+    }
+    return claimed;
+  }
+
+  /// Reports that MODE has been written after beginStepScaleWrite(), so the
+  /// next pulse uses the new scale.
+  void endStepScaleWrite()
+  {
+    ATOMIC_BLOCK()
+    {
+      if (timer.isRunning())
+      {
+        scaleWindow = ScaleWindow::Done;
+      }
+      else
+      {
+        stepScale = windowScale;
+        scaleWindow = ScaleWindow::None;
+      }
+    }
+  }
+
+  /// Returns the number of steps in a relative move of @p steps, which is
+  /// its magnitude, including for INT32_MIN.
+  static uint32_t distance(int32_t steps)
+  {
+    return steps < 0 ? (uint32_t)0 - (uint32_t)steps : (uint32_t)steps;
+  }
+
+  /// This object plans the moves started with move().
+  HPSDMotionPlanner planner;
+
+  /// This object is the hardware timer used by the engine.  You can use it to
+  /// check HPSDStepTimer::getOverrunCount().
+  HPSDStepTimer timer;
+
+protected:
+
+  /// The DRV8711 needs DIR to be stable for 200 ns before and after a rising
+  /// edge on STEP; the direction change gets a tick of its own so that the
+  /// timer enforces this.
+  static const uint32_t DirSetupUs = HPSDStepTimer::MinDelayUs;
+
+  enum class TickState : uint8_t
+  {
+    Idle,
+    StepLow,
+    StepHigh,
+    Direction,
+  };
+
+  /// The states of a step scale switch; see requestStepScale().
+  enum class ScaleWindow : uint8_t
+  {
+    None,
+    Open,
+    Writing,
+    Done,
+  };
+
+  /// How often the interrupt checks whether a MODE write has finished while
+  /// it is holding the next step for one.
+  static const uint32_t ScaleHoldUs = 10;
+
+  static uint32_t onTimer(void * context)
+  {
+    return ((HPSDStepEngine *)context)->tick();
+  }
+
+  /// Called from the timer interrupt when there are no more steps to take.
+  ///
+  /// @return 0, to stop the timer.
+  uint32_t finishMoves()
+  {
+    activePlanner = nullptr;
+    state = TickState::Idle;
+    HPSDMoveCompleteCallback callback = moveCompleteCallback;
+    if (callback != nullptr) { callback(moveCompleteContext); }
+    return 0;
+  }
+
+  void startSteps(uint32_t steps)
+  {
+    pinResetFast(stepPin);
+    state = TickState::StepLow;
+    stepsRemaining = steps;
+
+    if (steps)
+    {
+      timer.start(HPSDStepTimer::MinDelayUs);
+    }
+  }
+
+  /// Called from the timer interrupt (or with interrupts disabled) when the
+  /// current move is done.  Releases the move's queue segment and starts the
+  /// next one.
+  ///
+  /// @return The delay until the next tick, or 0 if there is nothing left to
+  /// do.
+  uint32_t startNextSegment()
+  {
+    if (queue == nullptr) { return finishMoves(); }
+
+    if (activeSegment != nullptr)
+    {
+      activeSegment = nullptr;
+      queue->release();
+    }
+
+    HPSDMoveSegment * segment;
+    while ((segment = queue->front()) != nullptr && segment->steps == 0)
+    {
+      queue->release();
+    }
+    if (segment == nullptr) { return finishMoves(); }
+
+    activeSegment = segment;
+    activePlanner = &segment->planner;
+    stepsRemaining = segment->steps;
+
+    if (dirPin != HPSD_NO_PIN && segment->reverse != reverse)
+    {
+      reverse = segment->reverse;
+      state = TickState::Direction;
+    }
+    else
+    {
+      state = TickState::StepLow;
+    }
+
+    // Space the first step of this segment from the last step of the previous
+    // one by the previous segment's final interval, so that a path planned to
+    // keep moving across the boundary does not get a double step there.  The
+    // falling edge of that step was StepPulseUs after it.
+    uint32_t gap = segmentGapUs;
+    segmentGapUs = 0;
+    uint32_t setup = state == TickState::Direction ? DirSetupUs : 0;
+    if (gap > StepPulseUs + setup + DirSetupUs)
+    {
+      return gap - StepPulseUs - setup;
+    }
+    return DirSetupUs;
+  }
+
+  /// Called from the timer interrupt when a step is taken.
+  ///
+  /// @return The time from this step to the next one in microseconds, or 0 if
+  /// this was the last step.
+  uint32_t nextPeriod()
+  {
+    HPSDMotionPlanner * p = activePlanner;
+    uint8_t scale = stepScale;
+    stepsRemaining -= scale;
+    if (stepsRemaining == 0)
+    {
+      segmentGapUs = p != nullptr ? p->getIntervalUs() * scale : 0;
+      return 0;
+    }
+
+    // Where the requested scale is valid, give the application one fine
+    // interval to write MODE.  The rest of the period of a coarse pulse is
+    // added in resolveStepScale().
+    uint8_t wanted = stepsRemaining < scale ? 1 : requestedScale;
+    if (wanted != scale && stepsRemaining >= wanted &&
+      (((uint32_t)position - (uint32_t)phaseOrigin) & (wanted - 1)) == 0)
+    {
+      windowScale = wanted;
+      scaleWindow = ScaleWindow::Open;
+      return intervals(1);
+    }
+
+    return intervals(scale);
+  }
+
+  /// Returns the sum of the next @p count intervals of the current move.
+  uint32_t intervals(uint8_t count)
+  {
+    HPSDMotionPlanner * p = activePlanner;
+    uint32_t period = 0;
+    for (uint8_t i = 0; i < count; i++)
+    {
+      uint32_t interval = p != nullptr ? p->nextInterval() : stepPeriodUs;
+      if (interval < MinStepPeriodUs) { interval = MinStepPeriodUs; }
+      period += interval;
+    }
+    return period;
+  }
+
+  /// Called from the timer interrupt before a pulse when a step scale switch
+  /// is in progress or the move has fewer steps left than a pulse takes.
+  ///
+  /// @return The time to wait before the pulse, or 0 to take it now.
+  uint32_t resolveStepScale()
+  {
+    switch (scaleWindow)
+    {
+    case ScaleWindow::Writing:
+      // The MODE frame is being sent; the pulse has to wait for it.
+      return ScaleHoldUs;
+
+    case ScaleWindow::Done:
+      stepScale = windowScale;
+      break;
+
+    case ScaleWindow::Open:
+      // The window was missed.  That is fine unless the old scale would
+      // overshoot the end of the move.
+      if (stepsRemaining < stepScale) { return ScaleHoldUs; }
+      break;
+
+    case ScaleWindow::None:
+      // A new move is shorter than one coarse pulse.
+      windowScale = 1;
+      scaleWindow = ScaleWindow::Open;
+      return ScaleHoldUs;
+    }
+
+    scaleWindow = ScaleWindow::None;
+
+    // One fine interval has passed since the last pulse; a coarse pulse
+    // waits for the rest of its intervals.
+    return stepScale > 1 ? intervals(stepScale - 1) : 0;
+  }
+
+  /// Called from the timer interrupt.  Each step takes two ticks: one to raise
+  /// the STEP pin and one to lower it again.
+  ///
+  /// @return The delay until the next tick, or 0 to stop.
+  uint32_t tick()
+  {
+    switch (state)
+    {
+    case TickState::StepHigh:
+      pinResetFast(stepPin);
+      state = TickState::StepLow;
+      if (currentPeriodUs != 0) { return currentPeriodUs - StepPulseUs; }
+
+      // That was the last step of the move; go on to the next queued one.
+      // Its first step comes at least a pulse width after this falling edge.
+      return startNextSegment();
+
+    case TickState::Direction:
+      if (reverse) { pinSetFast(dirPin); } else { pinResetFast(dirPin); }
+      state = TickState::StepLow;
+      return DirSetupUs;
+
+    case TickState::StepLow:
+      if (stepsRemaining == 0) { return startNextSegment(); }
+      if (scaleWindow != ScaleWindow::None || stepsRemaining < stepScale)
+      {
+        uint32_t delay = resolveStepScale();
+        if (delay != 0) { return delay; }
+      }
+      pinSetFast(stepPin);
+      state = TickState::StepHigh;
+      position = (int32_t)((uint32_t)position + (reverse ? -(uint32_t)stepScale : stepScale));
+
+      // Work out the next period while the pulse is high so that the falling
+      // edge is not delayed by it.
+      currentPeriodUs = nextPeriod();
+      return StepPulseUs;
+
+    default:
+      return 0;
+    }
+  }
+
+  uint8_t stepPin = HPSD_NO_PIN;
+  uint8_t dirPin = HPSD_NO_PIN;
+  volatile uint32_t stepPeriodUs = 1000;
+  volatile uint32_t stepsRemaining = 0;
+  volatile TickState state = TickState::Idle;
+
+  // The planner of the current move, or null for a move started with run().
+  HPSDMotionPlanner * volatile activePlanner = nullptr;
+
+  HPSDMoveQueueBase * queue = nullptr;
+  HPSDMoveSegment * activeSegment = nullptr;
+
+  // See setStepScale() and requestStepScale().
+  volatile uint8_t stepScale = 1;
+  volatile uint8_t requestedScale = 1;
+  volatile uint8_t windowScale = 1;
+  volatile ScaleWindow scaleWindow = ScaleWindow::None;
+  int32_t phaseOrigin = 0;
+
+  // See setQueueHold().
+  volatile bool queueHeld = false;
+  volatile bool queueStartPending = false;
+  volatile uint32_t queueStartRequestUs = 0;
+
+  // The direction of the current move.
+  volatile bool reverse = false;
+
+  volatile int32_t position = 0;
+
+  HighPowerStepperDriver * sd = nullptr;
+  uint32_t limitSpeed = 1000;
+  uint32_t limitAccel = 1000;
+  uint32_t limitJerk = 0;
+
+  HPSDMoveCompleteCallback volatile moveCompleteCallback = nullptr;
+  void * volatile moveCompleteContext = nullptr;
+
+  // Time from the rising edge of the current step to the next one.
+  uint32_t currentPeriodUs = 0;
+
+  // Time from the rising edge of the last step of a queued segment to the
+  // first step of the next segment.
+  uint32_t segmentGapUs = 0;
+};
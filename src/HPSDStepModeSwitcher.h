@@ -0,0 +1,150 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDStepModeSwitcher.h
+///
+/// This file defines the HPSDStepModeSwitcher class, which changes a driver
+/// to a coarser step mode at high speeds and back without losing position.
+
+#pragma once
+
+#include <Arduino.h>
+#include "HighPowerStepperDriver.h"
+#include "HPSDStepEngine.h"
+
+/// This class switches a driver between a fine step mode (such as 1/32 step)
+/// and a coarse one (such as 1/4 or full step) while its HPSDStepEngine is
+/// moving.
+///
+/// Above the up speed, the coarse mode cuts the STEP rate (and the timer
+/// interrupt rate) by the ratio of the two modes, which lets the engine reach
+/// speeds it could not pulse in the fine mode.  Below the down speed, such as
+/// near the end of a move, the fine mode is used again, so the move still
+/// ends smoothly and exactly on its target.
+///
+/// Moves, positions, and speeds stay in fine steps throughout: the engine
+/// counts each coarse pulse as several fine steps and times it with the sum of
+/// the planner's intervals for them (see HPSDStepEngine::setStepScale()).
+/// Switches only happen at positions where the DRV8711's indexer is at a
+/// valid state in both modes, so no position is lost.
+///
+/// The MODE field values are computed in begin(), and each switch is a single
+/// CTRL frame (HighPowerStepperDriver::writeStepMode()) sent from service()
+/// in the window that the engine opens between two pulses (see
+/// HPSDStepEngine::requestStepScale()).  Call service() as often as possible;
+/// if it misses a window, the switch happens at a later valid position.
+///
+/// The indexer must be at a full step when begin() is called, as it is after
+/// the driver is reset, or the coarse positions will be off; reset the
+/// driver's settings before calling it, or call HPSDStepEngine::setPhaseOrigin()
+/// with a position where the indexer is known to be at a full step.
+///
+/// Example usage:
+/// ~~~{.cpp}
+/// HPSDStepModeSwitcher modes;
+///
+/// void setup()
+/// {
+///   sd.resetSettings();
+///   engine.begin(sd);
+///   // 1/32 step normally, 1/4 step above 20000 microsteps per second.
+///   modes.begin(sd, engine, HPSDStepMode::MicroStep32, HPSDStepMode::MicroStep4,
+///     20000, 16000);
+///   engine.moveBy(320000, 80000, 40000);
+/// }
+///
+/// void loop()
+/// {
+///   modes.service();
+/// }
+/// ~~~
+class HPSDStepModeSwitcher
+{
+public:
+  /// Sets the driver and engine to use, the two step modes, and the speeds
+  /// in fine steps per second at which to switch to the coarse mode and back.
+  /// @p downSpeed should be lower than @p upSpeed so that the mode does not
+  /// switch back and forth at one speed.
+  ///
+  /// This sets the fine mode and takes the engine's position as the phase
+  /// origin.  The coarse mode must be coarser than the fine one, by a factor
+  /// of up to 128.
+  void begin(HighPowerStepperDriver & sd, HPSDStepEngine & engine,
+    HPSDStepMode fineMode, HPSDStepMode coarseMode, uint32_t upSpeed, uint32_t downSpeed)
+  {
+    this->sd = &sd;
+    this->engine = &engine;
+    this->upSpeed = upSpeed;
+    this->downSpeed = downSpeed;
+
+    uint16_t ratio = (uint16_t)fineMode / (uint16_t)coarseMode;
+    coarseScale = ratio >= 2 && ratio <= 128 ? ratio : 1;
+    fineBits = HPSDRegs::modeBits((uint16_t)fineMode);
+    coarseBits = HPSDRegs::modeBits((uint16_t)coarseMode);
+
+    engine.stop();
+    sd.writeStepMode(fineBits);
+    engine.setStepScale(1);
+    engine.setPhaseOrigin(engine.getPosition());
+  }
+
+  /// Writes MODE when the engine is waiting for it, and asks the engine for
+  /// the mode that suits its speed.  Call this as often as possible from
+  /// your main loop, not from an interrupt.
+  void service()
+  {
+    if (sd == nullptr) { return; }
+
+    if (engine->isStepScaleWindowOpen() && engine->beginStepScaleWrite())
+    {
+      sd->writeStepMode(engine->getStepScaleWindowTarget() > 1 ? coarseBits : fineBits);
+      engine->endStepScaleWrite();
+      switchCount++;
+      return;
+    }
+
+    uint8_t scale = engine->getStepScale();
+    if (!engine->isRunning())
+    {
+      // Start every move in the fine mode.
+      if (scale != 1)
+      {
+        sd->writeStepMode(fineBits);
+        engine->setStepScale(1);
+        switchCount++;
+      }
+      return;
+    }
+
+    uint32_t speed = engine->getSpeed();
+    if (speed >= upSpeed && coarseScale > 1)
+    {
+      engine->requestStepScale(coarseScale);
+    }
+    else if (speed < downSpeed)
+    {
+      engine->requestStepScale(1);
+    }
+  }
+
+  /// Returns true if the driver is in the coarse mode.
+  bool isCoarse() const
+  {
+    return engine != nullptr && engine->getStepScale() > 1;
+  }
+
+  /// Returns the number of mode switches so far.
+  uint32_t getSwitchCount() const
+  {
+    return switchCount;
+  }
+
+protected:
+  HighPowerStepperDriver * sd = nullptr;
+  HPSDStepEngine * engine = nullptr;
+  uint32_t upSpeed = 0;
+  uint32_t downSpeed = 0;
+  uint8_t coarseScale = 1;
+  uint8_t fineBits = 0;
+  uint8_t coarseBits = 0;
+  uint32_t switchCount = 0;
+};
@@ -0,0 +1,311 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+#include "HPSDStepTimer.h"
+
+#if PLATFORM_ID == 6 || PLATFORM_ID == 8 || PLATFORM_ID == 10
+
+// Gen 2 (STM32F205): TIM6 and TIM7 are basic 16-bit timers on APB1 that are
+// not otherwise used by Device OS or by any PWM pin.
+
+#include "stm32f2xx.h"
+
+static TIM_TypeDef * const hpsdTimers[HPSD_STEP_TIMER_COUNT] = { TIM6, TIM7 };
+static const IRQn_Type hpsdTimerIrqs[HPSD_STEP_TIMER_COUNT] = { TIM6_DAC_IRQn, TIM7_IRQn };
+static const uint32_t hpsdTimerClocks[HPSD_STEP_TIMER_COUNT] = { RCC_APB1ENR_TIM6EN, RCC_APB1ENR_TIM7EN };
+static const uint32_t hpsdMaxHardwareDelayUs = 0xFFFF;
+
+static void hpsdTimerInit(uint8_t slot)
+{
+  TIM_TypeDef * tim = hpsdTimers[slot];
+  RCC->APB1ENR |= hpsdTimerClocks[slot];
+  tim->CR1 = 0;
+
+  // The APB1 timer clock runs at half the core clock; count in microseconds.
+  tim->PSC = (SystemCoreClock / 2 / 1000000) - 1;
+  tim->ARR = 0xFFFF;
+  tim->EGR = TIM_EGR_UG;
+  tim->SR = 0;
+  tim->DIER = TIM_DIER_UIE;
+}
+
+static bool hpsdTimerAcknowledge(uint8_t slot)
+{
+  TIM_TypeDef * tim = hpsdTimers[slot];
+  if (!(tim->SR & TIM_SR_UIF)) { return false; }
+  tim->SR = ~TIM_SR_UIF;
+  return true;
+}
+
+static void hpsdTimerStart(uint8_t slot, uint32_t delayUs)
+{
+  TIM_TypeDef * tim = hpsdTimers[slot];
+  tim->CR1 &= ~TIM_CR1_CEN;
+  tim->CNT = 0;
+  tim->ARR = delayUs - 1;
+  tim->SR = 0;
+  tim->CR1 |= TIM_CR1_CEN;
+}
+
+static uint32_t hpsdTimerElapsed(uint8_t slot)
+{
+  // The counter restarted from 0 at the update event that caused the current
+  // interrupt.
+  return hpsdTimers[slot]->CNT;
+}
+
+static void hpsdTimerReload(uint8_t slot, uint32_t delayUs)
+{
+  hpsdTimers[slot]->ARR = delayUs - 1;
+}
+
+static void hpsdTimerStop(uint8_t slot)
+{
+  hpsdTimers[slot]->CR1 &= ~TIM_CR1_CEN;
+  hpsdTimers[slot]->SR = 0;
+}
+
+#elif PLATFORM_ID == 12 || PLATFORM_ID == 13 || PLATFORM_ID == 14 || PLATFORM_ID == 22 || PLATFORM_ID == 23 || PLATFORM_ID == 25
+
+// Gen 3 (nRF52840): TIMER3 and TIMER4 are 32-bit timers with six compare
+// channels that Device OS leaves free for applications.
+
+#include "nrf.h"
+
+static NRF_TIMER_Type * const hpsdTimers[HPSD_STEP_TIMER_COUNT] = { NRF_TIMER3, NRF_TIMER4 };
+static const IRQn_Type hpsdTimerIrqs[HPSD_STEP_TIMER_COUNT] = { TIMER3_IRQn, TIMER4_IRQn };
+static const uint32_t hpsdMaxHardwareDelayUs = 0xFFFFFFFF;
+
+static void hpsdTimerInit(uint8_t slot)
+{
+  NRF_TIMER_Type * t = hpsdTimers[slot];
+  t->TASKS_STOP = 1;
+  t->MODE = TIMER_MODE_MODE_Timer;
+  t->BITMODE = TIMER_BITMODE_BITMODE_32Bit;
+
+  // 16 MHz / 2^4 = 1 MHz.
+  t->PRESCALER = 4;
+  t->SHORTS = TIMER_SHORTS_COMPARE0_CLEAR_Msk;
+  t->INTENSET = TIMER_INTENSET_COMPARE0_Msk;
+}
+
+static bool hpsdTimerAcknowledge(uint8_t slot)
+{
+  NRF_TIMER_Type * t = hpsdTimers[slot];
+  if (!t->EVENTS_COMPARE[0]) { return false; }
+  t->EVENTS_COMPARE[0] = 0;
+  (void)t->EVENTS_COMPARE[0];
+  return true;
+}
+
+static void hpsdTimerStart(uint8_t slot, uint32_t delayUs)
+{
+  NRF_TIMER_Type * t = hpsdTimers[slot];
+  t->TASKS_STOP = 1;
+  t->TASKS_CLEAR = 1;
+  t->EVENTS_COMPARE[0] = 0;
+  t->CC[0] = delayUs;
+  t->TASKS_START = 1;
+}
+
+static uint32_t hpsdTimerElapsed(uint8_t slot)
+{
+  // The COMPARE0_CLEAR short restarted the counter at the compare event that
+  // caused the current interrupt.
+  NRF_TIMER_Type * t = hpsdTimers[slot];
+  t->TASKS_CAPTURE[1] = 1;
+  return t->CC[1];
+}
+
+static void hpsdTimerReload(uint8_t slot, uint32_t delayUs)
+{
+  hpsdTimers[slot]->CC[0] = delayUs;
+}
+
+static void hpsdTimerStop(uint8_t slot)
+{
+  hpsdTimers[slot]->TASKS_STOP = 1;
+  hpsdTimers[slot]->EVENTS_COMPARE[0] = 0;
+}
+
+#elif defined(HPSD_HOST)
+
+// Host builds (see test/Makefile): the simulated timers of the host shim,
+// which count simulated microseconds as hostAdvance() moves the time along.
+
+static const IRQn_Type hpsdTimerIrqs[HPSD_STEP_TIMER_COUNT] = { HostTimer0_IRQn, HostTimer1_IRQn };
+static const uint32_t hpsdMaxHardwareDelayUs = 0xFFFFFFFF;
+
+static void hpsdTimerInit(uint8_t slot)
+{
+  hostTimers[slot].enabled = false;
+  hostTimers[slot].event = false;
+}
+
+static bool hpsdTimerAcknowledge(uint8_t slot)
+{
+  HostTimer & t = hostTimers[slot];
+  if (!t.event) { return false; }
+  t.event = false;
+  return true;
+}
+
+static void hpsdTimerStart(uint8_t slot, uint32_t delayUs)
+{
+  HostTimer & t = hostTimers[slot];
+  t.count = 0;
+  t.reload = delayUs;
+  t.event = false;
+  t.enabled = true;
+}
+
+static uint32_t hpsdTimerElapsed(uint8_t slot)
+{
+  return hostTimers[slot].count;
+}
+
+static void hpsdTimerReload(uint8_t slot, uint32_t delayUs)
+{
+  hostTimers[slot].reload = delayUs;
+}
+
+static void hpsdTimerStop(uint8_t slot)
+{
+  hostTimers[slot].enabled = false;
+  hostTimers[slot].event = false;
+}
+
+#else
+#error "HPSDStepTimer does not support this platform."
+#endif
+
+HPSDStepTimer * HPSDStepTimer::slots[HPSD_STEP_TIMER_COUNT];
+
+bool HPSDStepTimer::begin(HPSDStepTimerCallback callback, void * context)
+{
+  end();
+
+  for (uint8_t i = 0; i < HPSD_STEP_TIMER_COUNT; i++)
+  {
+    if (slots[i] == nullptr)
+    {
+      slots[i] = this;
+      slot = i;
+      this->callback = callback;
+      this->context = context;
+      hpsdTimerInit(i);
+      attachInterruptDirect(hpsdTimerIrqs[i], i == 0 ? isr0 : isr1);
+      return true;
+    }
+  }
+  return false;
+}
+
+void HPSDStepTimer::end()
+{
+  if (slot < 0) { return; }
+  stop();
+  detachInterruptDirect(hpsdTimerIrqs[slot]);
+  slots[slot] = nullptr;
+  slot = -1;
+}
+
+void HPSDStepTimer::start(uint32_t delayUs)
+{
+  if (slot < 0) { return; }
+  if (delayUs < MinDelayUs) { delayUs = MinDelayUs; }
+
+  uint32_t hardwareDelay = delayUs;
+  if (hardwareDelay > hpsdMaxHardwareDelayUs) { hardwareDelay = hpsdMaxHardwareDelayUs; }
+  remainingUs = delayUs - hardwareDelay;
+
+  running = true;
+  hpsdTimerStart(slot, hardwareDelay);
+}
+
+void HPSDStepTimer::stop()
+{
+  running = false;
+  if (slot >= 0)
+  {
+    hpsdTimerStop(slot);
+  }
+}
+
+void HPSDStepTimer::arm(uint32_t delayUs, bool fromIsr)
+{
+  uint32_t hardwareDelay = delayUs;
+  if (hardwareDelay > hpsdMaxHardwareDelayUs) { hardwareDelay = hpsdMaxHardwareDelayUs; }
+  remainingUs = delayUs - hardwareDelay;
+
+  if (fromIsr)
+  {
+    // If the callback took longer than the delay it asked for, the counter is
+    // already past the new reload value and would run all the way around
+    // before expiring.  Push the deadline out just enough to catch it.
+    uint32_t elapsed = hpsdTimerElapsed(slot);
+    if (hardwareDelay < elapsed + MinDelayUs)
+    {
+      hardwareDelay = elapsed + MinDelayUs;
+      overruns++;
+    }
+  }
+
+  hpsdTimerReload(slot, hardwareDelay);
+}
+
+void HPSDStepTimer::expire()
+{
+  if (!running) { return; }
+
+  if (remainingUs)
+  {
+    arm(remainingUs, true);
+    return;
+  }
+
+#ifdef HPSD_STEP_STATS
+  recordLateness(hpsdTimerElapsed(slot));
+#endif
+
+  uint32_t delayUs = callback(context);
+  if (delayUs == 0 || !running)
+  {
+    stop();
+    return;
+  }
+  arm(delayUs, true);
+}
+
+#ifdef HPSD_STEP_STATS
+void HPSDStepTimer::recordLateness(uint32_t lateUs)
+{
+  // The bucket is the bit length of the lateness.
+  uint8_t bucket = lateUs ? 32 - __builtin_clz(lateUs) : 0;
+  if (bucket >= HPSD_JITTER_BUCKETS) { bucket = HPSD_JITTER_BUCKETS - 1; }
+
+  jitter.buckets[bucket]++;
+  jitter.samples++;
+  if (lateUs > jitter.maxLateUs) { jitter.maxLateUs = lateUs; }
+  if (lateUs > missThresholdUs) { jitter.missed++; }
+}
+#endif
+
+void HPSDStepTimer::dispatch(uint8_t slot)
+{
+  if (!hpsdTimerAcknowledge(slot)) { return; }
+  HPSDStepTimer * timer = slots[slot];
+  if (timer != nullptr)
+  {
+    timer->expire();
+  }
+}
+
+void HPSDStepTimer::isr0()
+{
+  dispatch(0);
+}
+
+void HPSDStepTimer::isr1()
+{
+  dispatch(1);
+}
@@ -0,0 +1,173 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDStepTimer.h
+///
+/// This file defines the HPSDStepTimer class, a thin wrapper around one of the
+/// microcontroller's hardware timers that the HighPowerStepperDriver library
+/// uses to schedule STEP edges from an interrupt instead of from a busy-wait
+/// loop.
+
+#pragma once
+
+#include <Arduino.h>
+
+/// The number of hardware timers reserved for this library.  Each
+/// HPSDStepTimer object that has been started with begin() uses one of them.
+///
+/// On Gen 2 devices (Photon, P1, Electron) the library uses the basic timers
+/// TIM6 and TIM7.  On Gen 3 devices (Argon, Boron, Xenon) it uses TIMER3 and
+/// TIMER4.  Your application should not use these timers for anything else.
+#define HPSD_STEP_TIMER_COUNT 2
+
+/// The type of function that HPSDStepTimer calls from its interrupt.
+///
+/// The function receives the context pointer that was passed to
+/// HPSDStepTimer::begin() and returns the number of microseconds until it
+/// should be called again, or 0 to stop the timer.
+typedef uint32_t (*HPSDStepTimerCallback)(void * context);
+
+#ifdef HPSD_STEP_STATS
+
+/// The number of buckets in HPSDStepJitter::buckets.
+#define HPSD_JITTER_BUCKETS 12
+
+/// A histogram of how late an HPSDStepTimer's callback ran compared to its
+/// scheduled time, collected when HPSD_STEP_STATS is defined for the whole
+/// build.
+///
+/// The lateness is read from the hardware counter, which restarts at the
+/// scheduled time, so the resolution is 1 microsecond.
+struct HPSDStepJitter
+{
+  /// Bucket 0 counts callbacks that ran less than 1 us late.  Bucket n counts
+  /// lateness from 2^(n-1) to 2^n - 1 us, and the last bucket also counts
+  /// everything beyond.
+  uint32_t buckets[HPSD_JITTER_BUCKETS];
+
+  /// The total number of callbacks measured.
+  uint32_t samples;
+
+  /// The latest any callback ran, in microseconds.
+  uint32_t maxLateUs;
+
+  /// The number of callbacks that ran later than the miss threshold (see
+  /// HPSDStepTimer::setMissThreshold()).
+  uint32_t missed;
+};
+
+#endif
+
+/// This class provides a one-shot, re-triggerable hardware timer with a
+/// resolution of 1 microsecond.
+///
+/// Each delay returned by the callback is measured from the moment the previous
+/// delay expired, not from when the callback finished running, so interrupt
+/// latency does not accumulate from one period to the next.
+///
+/// Most users should use the HPSDStepEngine class, which uses this class to
+/// generate step pulses, instead of this class.
+class HPSDStepTimer
+{
+public:
+  /// The shortest delay the timer will schedule.  Shorter delays requested by
+  /// the callback (including delays that have already passed by the time the
+  /// callback returns) are stretched to this length.
+  static const uint32_t MinDelayUs = 2;
+
+  ~HPSDStepTimer()
+  {
+    end();
+  }
+
+  /// Claims one of the hardware timers reserved for this library and
+  /// configures it to call the specified function.
+  ///
+  /// @return true if a timer was available, false if all of them are already
+  /// in use.
+  bool begin(HPSDStepTimerCallback callback, void * context);
+
+  /// Stops the timer and releases the hardware timer so another object can
+  /// claim it.
+  void end();
+
+  /// Starts the timer.  The callback will be called after the specified number
+  /// of microseconds, and after that, as long as it returns a non-zero delay.
+  void start(uint32_t delayUs);
+
+  /// Stops the timer.  The callback will not be called again until start() is
+  /// called.
+  ///
+  /// It is safe to call this from an interrupt.
+  void stop();
+
+  /// Returns true if the timer is running.
+  bool isRunning() const
+  {
+    return running;
+  }
+
+  /// Returns the number of times the callback asked for a delay that had
+  /// already passed (or was shorter than MinDelayUs) by the time it returned.
+  ///
+  /// A non-zero value means the callback is taking too long for the requested
+  /// step rate.
+  uint32_t getOverrunCount() const
+  {
+    return overruns;
+  }
+
+#ifdef HPSD_STEP_STATS
+  /// Copies the lateness histogram into @p jitter.  This can be called while
+  /// the timer is running.
+  void getJitter(HPSDStepJitter & jitter) const
+  {
+    ATOMIC_BLOCK()
+    {
+      jitter = this->jitter;
+    }
+  }
+
+  /// Clears the lateness histogram.
+  void resetJitter()
+  {
+    ATOMIC_BLOCK()
+    {
+      memset(&jitter, 0, sizeof(jitter));
+    }
+  }
+
+  /// Sets how late, in microseconds, a callback can run before it counts as a
+  /// missed deadline.  The default is MinDelayUs.
+  void setMissThreshold(uint32_t lateUs)
+  {
+    missThresholdUs = lateUs;
+  }
+#endif
+
+private:
+  static void dispatch(uint8_t slot);
+  static void isr0();
+  static void isr1();
+
+  void expire();
+  void arm(uint32_t delayUs, bool fromIsr);
+
+  static HPSDStepTimer * slots[HPSD_STEP_TIMER_COUNT];
+
+  int8_t slot = -1;
+  HPSDStepTimerCallback callback = nullptr;
+  void * context = nullptr;
+  volatile bool running = false;
+
+  // Portion of a long delay that did not fit in the hardware counter.
+  uint32_t remainingUs = 0;
+
+  volatile uint32_t overruns = 0;
+
+#ifdef HPSD_STEP_STATS
+  void recordLateness(uint32_t lateUs);
+
+  HPSDStepJitter jitter = {};
+  uint32_t missThresholdUs = MinDelayUs;
+#endif
+};
@@ -0,0 +1,420 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDTelemetry.h
+///
+/// This file defines the HPSDTelemetry class, which samples the state of
+/// several axes at a fixed rate and sends it in compact binary packets.
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "HighPowerStepperDriver.h"
+#include "HPSDStepEngine.h"
+
+/// The type of function that HPSDTelemetry calls to send a packet.
+typedef void (*HPSDTelemetrySendCallback)(void * context, const uint8_t * data, uint16_t length);
+
+/// Bits in the flags byte of each axis in an HPSDTelemetry sample.
+enum class HPSDTelemetryFlag : uint8_t
+{
+  /// The STATUS byte follows, because it changed.
+  Status = 0,
+
+  /// The current setting follows, because it changed.
+  Current = 1,
+
+  /// The FAULTn pin is attached and low.
+  FaultPin = 2,
+
+  /// The STALLn pin is attached and low.
+  StallPin = 3,
+
+  /// The driver outputs are enabled.
+  Enabled = 4,
+};
+
+/// This class records the position, velocity, STATUS bits, and current
+/// setting of up to @p MaxAxes axes into a ring buffer of @p Samples samples,
+/// and sends them in batches as delta-encoded binary packets.
+///
+/// Taking a sample only copies values the library already has, with no SPI
+/// and no formatting, so it takes a few hundred CPU cycles.  The STATUS byte
+/// comes from HighPowerStepperDriver::getLatchedStatus() (updated by
+/// serviceStatus() after a FAULTn or STALLn pin event), or, if
+/// setStatusPolling() is used, from reading STATUS every few samples in
+/// service().  The levels of the FAULTn and STALLn pins are in every sample.
+///
+/// Encoding is done when a batch is sent, also from service(), so the cost
+/// of sampling does not depend on the output.
+///
+/// ## Packet format
+///
+/// Multi-byte fixed fields are little-endian.  A *varint* is an unsigned
+/// number sent 7 bits at a time, least significant first, with bit 7 set in
+/// every byte but the last.  A *zigzag* varint is a signed number @p n sent as
+/// the varint `(n << 1) ^ (n >> 31)`, so small negative numbers stay short.
+///
+/// Field         | Size   | Contents
+/// ------------- | ------ | --------------------------------------------------
+/// magic         | 2      | `0x48 0x54` ("HT")
+/// length        | 2      | The number of bytes from version to the last sample.
+/// version       | 1      | 1
+/// axes          | 1      | The number of axes in each sample.
+/// sequence      | 2      | The sequence number of the first sample.
+/// count         | 1      | The number of samples.
+/// samples       | varies | See below.
+/// checksum      | 2      | Fletcher-16 from version to the last sample.
+///
+/// Samples that were dropped because the buffer was full still use up a
+/// sequence number.  The samples in a packet always have consecutive numbers,
+/// so a packet ends early at a dropped sample, and a gap between the end of
+/// one packet and the start of the next shows how many were dropped.  The
+/// checksum is sent as sum1 followed by sum2.
+///
+/// Each sample is a varint time in microseconds followed by each axis:
+/// a flags byte (#HPSDTelemetryFlag bits), a zigzag position in steps, a
+/// zigzag velocity in steps per second (negative in the reverse direction),
+/// the new STATUS byte if the Status flag is set, and a zigzag current
+/// setting, `(ISGAIN << 8) | TORQUE`, if the Current flag is set.
+///
+/// The time, position, velocity, and current are differences from the same
+/// numbers in the previous sample of the packet.  The first sample of a
+/// packet is relative to a time of 0 (so it is the low 32 bits of micros())
+/// and to an axis with every value 0, so each packet can be decoded on its
+/// own, even when UDP loses the one before it.
+///
+/// Example usage:
+/// ~~~{.cpp}
+/// UDP udp;
+/// HPSDTelemetry<2, 256> telemetry;
+///
+/// void sendTelemetry(void * context, const uint8_t * data, uint16_t length)
+/// {
+///   udp.sendPacket(data, length, IPAddress(192, 168, 1, 10), 9000);
+/// }
+///
+/// void setup()
+/// {
+///   udp.begin(9000);
+///   telemetry.addAxis(sdX, &engineX);
+///   telemetry.addAxis(sdY, &engineY);
+///   telemetry.setSampleInterval(2000);
+///   telemetry.setSendCallback(sendTelemetry);
+/// }
+///
+/// void loop()
+/// {
+///   telemetry.service();
+/// }
+/// ~~~
+///
+/// Over Serial, send the packet with `Serial.write(data, length)`; a reader
+/// can find the start of a packet by looking for the magic bytes and
+/// checking the length and checksum.
+template <uint8_t MaxAxes, uint16_t Samples> class HPSDTelemetry
+{
+  static_assert(MaxAxes >= 1 && MaxAxes <= 16, "HPSDTelemetry supports 1 to 16 axes.");
+  static_assert(Samples >= 2 && Samples <= 32768 && (Samples & (Samples - 1)) == 0,
+    "HPSDTelemetry sample count must be a power of two.");
+
+public:
+  /// The largest packet this class sends, in bytes.  This fits in one
+  /// Ethernet frame, so UDP does not have to fragment it.
+  static const uint16_t MaxPacketSize = 512;
+
+  /// Adds a driver to sample, along with the engine that steps it (or null,
+  /// in which case the position and velocity are sent as 0).  Add every axis
+  /// before sampling starts.
+  ///
+  /// @return The index of the new axis, or -1 if there are already
+  /// @p MaxAxes axes.
+  int8_t addAxis(HighPowerStepperDriver & sd, HPSDStepEngine * engine = nullptr)
+  {
+    if (axisCount >= MaxAxes) { return -1; }
+    axes[axisCount].driver = &sd;
+    axes[axisCount].engine = engine;
+    axes[axisCount].status = 0;
+    return axisCount++;
+  }
+
+  /// Sets the time between samples taken by service(), in microseconds, or 0
+  /// to only take samples when sample() is called.  The default is 10000
+  /// (100 samples per second).
+  void setSampleInterval(uint32_t us)
+  {
+    sampleIntervalUs = us;
+    nextSampleUs = micros();
+  }
+
+  /// Sets the largest number of samples to put in one packet.  Packets are
+  /// also ended early to stay within #MaxPacketSize.  The default is 32.
+  void setBatchSize(uint8_t samples)
+  {
+    batchSize = samples ? samples : 1;
+  }
+
+  /// Makes service() read the STATUS register of every axis (one SPI frame
+  /// each) once every @p samples samples, or never if @p samples is 0 (the
+  /// default).
+  void setStatusPolling(uint16_t samples)
+  {
+    statusPollSamples = samples;
+    statusPollCount = 0;
+  }
+
+  /// Sets the function that sends each packet.  It is called from service().
+  void setSendCallback(HPSDTelemetrySendCallback callback, void * context = nullptr)
+  {
+    this->callback = callback;
+    this->context = context;
+  }
+
+  /// Takes one sample of every axis now.
+  ///
+  /// This does not use SPI, so it is safe to call from an interrupt, such as
+  /// a hardware timer for more regular sampling than service() gives.  The
+  /// buffer is safe for one context calling this and another calling
+  /// service().
+  ///
+  /// @return false if the buffer was full, in which case the sample is
+  /// dropped (and its sequence number skipped).
+  bool sample()
+  {
+    uint16_t h = head.load(std::memory_order_relaxed);
+    if ((uint16_t)(h - tail.load(std::memory_order_acquire)) >= Samples)
+    {
+      dropped++;
+      nextSequence++;
+      return false;
+    }
+
+    Sample & s = samples[h & (Samples - 1)];
+    s.timeUs = micros();
+    s.sequence = nextSequence++;
+    for (uint8_t i = 0; i < axisCount; i++)
+    {
+      const Axis & axis = axes[i];
+      HighPowerStepperDriver & sd = *axis.driver;
+      AxisSample & a = s.axes[i];
+      if (axis.engine != nullptr)
+      {
+        int32_t speed = axis.engine->getSpeed();
+        a.position = axis.engine->getPosition();
+        a.speed = axis.engine->getDirection() ? -speed : speed;
+      }
+      else
+      {
+        a.position = 0;
+        a.speed = 0;
+      }
+      a.status = statusPollSamples ? axis.status : sd.getLatchedStatus();
+      a.current = ((uint16_t)sd.getGain() << 8) | sd.getTorque();
+      a.pins = (sd.isFaultPinLow() ? 1 << (uint8_t)HPSDTelemetryFlag::FaultPin : 0) |
+        (sd.isStallPinLow() ? 1 << (uint8_t)HPSDTelemetryFlag::StallPin : 0) |
+        (sd.getEnabled() ? 1 << (uint8_t)HPSDTelemetryFlag::Enabled : 0);
+    }
+
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Takes a sample when one is due, and sends a packet when a batch is full.
+  /// Call this as often as possible from your main loop, not from an
+  /// interrupt.
+  void service()
+  {
+    if (sampleIntervalUs != 0 && (int32_t)(micros() - nextSampleUs) >= 0)
+    {
+      pollStatus();
+      sample();
+      nextSampleUs += sampleIntervalUs;
+
+      // If the loop fell more than a sample behind, start again from now
+      // rather than taking a burst of samples to catch up.
+      if ((int32_t)(micros() - nextSampleUs) >= (int32_t)sampleIntervalUs)
+      {
+        nextSampleUs = micros() + sampleIntervalUs;
+      }
+    }
+
+    uint16_t n = pending();
+    if (n >= batchSize || n >= Samples) { flush(); }
+  }
+
+  /// Sends every sample in the buffer now, in as many packets as it takes.
+  void flush()
+  {
+    while (pending() != 0 && sendPacket()) {}
+  }
+
+  /// Returns the number of samples waiting to be sent.
+  uint16_t pending() const
+  {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+
+  /// Returns the number of samples dropped because the buffer was full.
+  uint32_t getDroppedCount() const
+  {
+    return dropped;
+  }
+
+  /// Returns the number of packets sent.
+  uint32_t getPacketCount() const
+  {
+    return packetCount;
+  }
+
+protected:
+
+  struct Axis
+  {
+    HighPowerStepperDriver * driver;
+    HPSDStepEngine * engine;
+    uint8_t status;
+  };
+
+  struct AxisSample
+  {
+    int32_t position;
+    int32_t speed;
+    uint16_t current;
+    uint8_t status;
+    uint8_t pins;
+  };
+
+  struct Sample
+  {
+    uint32_t timeUs;
+    uint16_t sequence;
+    AxisSample axes[MaxAxes];
+  };
+
+  static const uint8_t HeaderSize = 9;
+
+  /// The most bytes one sample can take: a 5-byte time, and for each axis a
+  /// flags byte, two 5-byte numbers, STATUS, and a 3-byte current.
+  static const uint16_t MaxSampleSize = 5 + MaxAxes * (1 + 5 + 5 + 1 + 3);
+
+  static_assert(HeaderSize + MaxSampleSize + 2 <= MaxPacketSize,
+    "HPSDTelemetry samples with this many axes do not fit in a packet.");
+
+  void pollStatus()
+  {
+    if (statusPollSamples == 0) { return; }
+    if (statusPollCount == 0)
+    {
+      for (uint8_t i = 0; i < axisCount; i++) { axes[i].status = axes[i].driver->readStatus(); }
+      statusPollCount = statusPollSamples;
+    }
+    statusPollCount--;
+  }
+
+  void putVarint(uint32_t value)
+  {
+    while (value >= 0x80)
+    {
+      packet[length++] = (uint8_t)value | 0x80;
+      value >>= 7;
+    }
+    packet[length++] = value;
+  }
+
+  void putZigzag(int32_t value)
+  {
+    putVarint(((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+  }
+
+  /// Encodes the oldest samples into one packet and sends it.
+  ///
+  /// @return false if there is no callback to send it with.
+  bool sendPacket()
+  {
+    if (callback == nullptr) { return false; }
+
+    uint16_t t = tail.load(std::memory_order_relaxed);
+    uint16_t available = head.load(std::memory_order_acquire) - t;
+
+    length = HeaderSize;
+    uint32_t lastTime = 0;
+    AxisSample last[MaxAxes] = {};
+    const Sample & first = samples[t & (Samples - 1)];
+    uint8_t count = 0;
+    while (count < available && count < batchSize &&
+      length + MaxSampleSize + 2 <= MaxPacketSize)
+    {
+      const Sample & s = samples[(uint16_t)(t + count) & (Samples - 1)];
+
+      // Only the first sequence number is sent, so end the packet at a gap.
+      if (s.sequence != (uint16_t)(first.sequence + count)) { break; }
+
+      putVarint(s.timeUs - lastTime);
+      lastTime = s.timeUs;
+
+      for (uint8_t i = 0; i < axisCount; i++)
+      {
+        const AxisSample & a = s.axes[i];
+        AxisSample & p = last[i];
+        uint8_t flags = a.pins;
+        if (a.status != p.status) { flags |= 1 << (uint8_t)HPSDTelemetryFlag::Status; }
+        if (a.current != p.current) { flags |= 1 << (uint8_t)HPSDTelemetryFlag::Current; }
+        packet[length++] = flags;
+        putZigzag(a.position - p.position);
+        putZigzag(a.speed - p.speed);
+        if (a.status != p.status) { packet[length++] = a.status; }
+        if (a.current != p.current) { putZigzag(a.current - p.current); }
+        p = a;
+      }
+      count++;
+    }
+
+    uint16_t payload = length - 4;
+    packet[0] = 'H';
+    packet[1] = 'T';
+    packet[2] = payload;
+    packet[3] = payload >> 8;
+    packet[4] = 1;
+    packet[5] = axisCount;
+    packet[6] = first.sequence;
+    packet[7] = first.sequence >> 8;
+    packet[8] = count;
+
+    uint16_t sum1 = 0, sum2 = 0;
+    for (uint16_t i = 4; i < length; i++)
+    {
+      sum1 = (sum1 + packet[i]) % 255;
+      sum2 = (sum2 + sum1) % 255;
+    }
+    packet[length++] = sum1;
+    packet[length++] = sum2;
+
+    // Free the samples before sending, since sending can take a while.
+    tail.store(t + count, std::memory_order_release);
+    callback(context, packet, length);
+    packetCount++;
+    return true;
+  }
+
+  Axis axes[MaxAxes];
+  uint8_t axisCount = 0;
+
+  Sample samples[Samples];
+  std::atomic<uint16_t> head{0};
+  std::atomic<uint16_t> tail{0};
+  uint16_t nextSequence = 0;
+  volatile uint32_t dropped = 0;
+
+  uint32_t sampleIntervalUs = 10000;
+  uint32_t nextSampleUs = 0;
+  uint8_t batchSize = 32;
+  uint16_t statusPollSamples = 0;
+  uint16_t statusPollCount = 0;
+
+  HPSDTelemetrySendCallback callback = nullptr;
+  void * context = nullptr;
+  uint32_t packetCount = 0;
+
+  uint8_t packet[MaxPacketSize];
+  uint16_t length = 0;
+};
@@ -0,0 +1,33 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HPSDTransport.h
+///
+/// This file defines the HPSDTransport interface, which lets DRV8711SPI send
+/// its frames somewhere other than the SPI peripheral.
+
+#pragma once
+
+#include <stdint.h>
+
+/// An interface for exchanging 16-bit DRV8711 frames.
+///
+/// DRV8711SPI normally talks to the SPI peripheral and the chip select pin
+/// directly.  If you give it a transport with DRV8711SPI::setTransport(),
+/// every frame it would have sent (blocking, batched, asynchronous, or
+/// through an HPSDSpiBus) is passed to transfer() instead.  This is mainly
+/// useful with HPSDMockDRV8711, so that the driver logic can run without
+/// hardware.
+class HPSDTransport
+{
+public:
+  /// Sends one frame as a complete chip select cycle and returns the 16 bits
+  /// that were shifted back.
+  ///
+  /// The frame has the DRV8711 layout: bit 15 is set for a read, bits 14:12
+  /// are the register address, and bits 11:0 are the data for a write.  For a
+  /// read, the register's value is in bits 11:0 of the return value.
+  virtual uint16_t transfer(uint16_t frame) = 0;
+
+protected:
+  ~HPSDTransport() {}
+};
@@ -1 +1,40 @@
-// This file is intentionally left blank.
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+#include "HighPowerStepperDriver.h"
+
+DRV8711SPI * volatile DRV8711SPI::asyncOwner = nullptr;
+
+void DRV8711SPI::asyncDmaDone()
+{
+  DRV8711SPI * owner = asyncOwner;
+  if (owner != nullptr)
+  {
+    owner->asyncFrameDone();
+  }
+}
+
+void DRV8711SPI::asyncFrameDone()
+{
+  // The CS line must go low after each frame for a write to take effect.
+  pinResetFast(csPin);
+
+  uint8_t tail = asyncTail;
+  volatile uint16_t * result = asyncResults[tail];
+  if (result != nullptr)
+  {
+    *result = ((asyncRx[0] << 8) | asyncRx[1]) & 0xFFF;
+  }
+  asyncTail = tail = (tail + 1) % HPSD_ASYNC_QUEUE_SIZE;
+
+  if (tail != asyncHead)
+  {
+    startAsyncFrame();
+    return;
+  }
+
+  asyncBusy = false;
+  if (asyncCallback != nullptr)
+  {
+    asyncCallback(asyncContext);
+  }
+}
@@ -15,7 +15,11 @@
 #pragma once
 
 #include <Arduino.h>
+#include "HPSDTransport.h"
 
+#ifdef HPSD_SPI_STATS
+#include "HPSDSpiStats.h"
+#endif
 
 /// Addresses of control and status registers.
 enum class HPSDRegAddr : uint8_t
@@ -31,6 +35,35 @@ enum class HPSDRegAddr : uint8_t
 };
 
 
+/// Pass this instead of a pin number to indicate that a pin is not connected.
+#define HPSD_NO_PIN 0xFF
+
+/// The SPI clock frequency that DRV8711SPI uses by default, in Hz.
+#define HPSD_SPI_DEFAULT_CLOCK 500000
+
+/// The highest SPI clock frequency the DRV8711 supports (a 250 ns minimum
+/// SCLK period), in Hz.
+#define HPSD_SPI_MAX_CLOCK 4000000
+
+class HPSDSpiBus;
+
+/// One register write for DRV8711SPI::writeRegs().
+struct HPSDRegWrite
+{
+  HPSDRegAddr address;
+  uint16_t value;
+};
+
+
+/// The number of 16-bit frames that can be waiting in a DRV8711SPI object's
+/// asynchronous queue.
+#define HPSD_ASYNC_QUEUE_SIZE 8
+
+/// The type of function that DRV8711SPI calls from an interrupt when its
+/// asynchronous queue has been sent.
+typedef void (*HPSDAsyncCallback)(void * context);
+
+
 /// This class provides low-level functions for reading and writing from the SPI
 /// interface of a DRV8711 stepper motor controller IC.
 ///
@@ -41,7 +74,8 @@ class DRV8711SPI
 public:
   /// Configures this object to use the specified pin as a chip select pin.
   ///
-  /// You must use a chip select pin; the DRV8711 requires it.
+  /// You must use a chip select pin; the DRV8711 requires it.  (It is not
+  /// used if you set a transport with setTransport().)
   void setChipSelectPin(uint8_t pin)
   {
     csPin = pin;
@@ -49,6 +83,26 @@ public:
     pinMode(csPin, OUTPUT);
   }
 
+  /// Sets the SPI clock frequency used to talk to this driver, in Hz.
+  ///
+  /// The default is #HPSD_SPI_DEFAULT_CLOCK, which is conservative.  With short
+  /// wiring, the DRV8711 works at up to #HPSD_SPI_MAX_CLOCK;
+  /// HighPowerStepperDriver::tuneClockSpeed() can find the fastest rate that
+  /// works reliably on your board.  The SPI peripheral rounds the frequency
+  /// down to a rate it can generate.
+  void setClockSpeed(uint32_t hz)
+  {
+    finishAsync();
+    clockSpeed = hz;
+    settings = SPISettings(hz, MSBFIRST, SPI_MODE0);
+  }
+
+  /// Returns the SPI clock frequency set with setClockSpeed(), in Hz.
+  uint32_t getClockSpeed() const
+  {
+    return clockSpeed;
+  }
+
   /// Reads the register at the given address and returns its raw value.
   uint16_t readReg(uint8_t address)
   {
@@ -56,9 +110,14 @@ public:
     // byte; data is in the remaining 4 bits of the first byte combined with
     // the second byte (12 bits total).
 
-    selectChip();
-    uint16_t dataOut = transfer((0x8 | (address & 0b111)) << 12);
-    deselectChip();
+    finishAllAsync();
+#ifdef HPSD_SPI_STATS
+    uint32_t start = System.ticks();
+#endif
+    uint16_t dataOut = exchange((0x8 | (address & 0b111)) << 12);
+#ifdef HPSD_SPI_STATS
+    stats.reads[address & 0b111].record(System.ticks() - start);
+#endif
     return dataOut & 0xFFF;
   }
 
@@ -75,12 +134,14 @@ public:
     // byte; data is in the remaining 4 bits of the first byte combined with
     // the second byte (12 bits total).
 
-    selectChip();
-    transfer(((address & 0b111) << 12) | (value & 0xFFF));
-
-    // The CS line must go low after writing for the value to actually take
-    // effect.
-    deselectChip();
+    finishAllAsync();
+#ifdef HPSD_SPI_STATS
+    uint32_t start = System.ticks();
+#endif
+    exchange(((address & 0b111) << 12) | (value & 0xFFF));
+#ifdef HPSD_SPI_STATS
+    stats.writes[address & 0b111].record(System.ticks() - start);
+#endif
   }
 
   /// Writes the specified value to a register.
@@ -89,9 +150,179 @@ public:
     writeReg((uint8_t)address, value);
   }
 
+  /// Writes several registers in one SPI transaction.
+  ///
+  /// The registers are written in the order given.  The bus is acquired and
+  /// configured once for the whole list, and the chip select pin is only
+  /// pulsed low between frames, which the DRV8711 needs to latch each write.
+  /// This is much faster than calling writeReg() once per register.
+  void writeRegs(const HPSDRegWrite * writes, uint8_t count)
+  {
+    finishAllAsync();
+#ifdef HPSD_SPI_STATS
+    uint32_t start = System.ticks();
+#endif
+    if (bus) { lockBus(); }
+    if (!transport) { SPI.beginTransaction(settings); }
+    for (uint8_t i = 0; i < count; i++)
+    {
+      transferFrame((((uint8_t)writes[i].address & 0b111) << 12) | (writes[i].value & 0xFFF));
+#ifdef HPSD_SPI_STATS
+      stats.writes[(uint8_t)writes[i].address & 0b111].count++;
+#endif
+    }
+    if (!transport) { SPI.endTransaction(); }
+    if (bus) { unlockBus(); }
+#ifdef HPSD_SPI_STATS
+    stats.batches.record(System.ticks() - start);
+#endif
+  }
+
+  /// Makes this object share the SPI bus through the specified bus manager,
+  /// or stops sharing if @p bus is null.
+  ///
+  /// While attached, every blocking transfer made by this object holds the
+  /// bus manager's lock, so transfers from different threads to different
+  /// drivers on the same bus cannot interleave.  Usually you would call
+  /// HPSDSpiBus::attach() instead of this.
+  void setBus(HPSDSpiBus * bus)
+  {
+    finishAsync();
+    this->bus = bus;
+  }
+
+  /// Returns the bus manager set with setBus(), or null.
+  HPSDSpiBus * getBus() const
+  {
+    return bus;
+  }
+
+  /// Acquires the lock of the bus manager set with setBus(), so that a
+  /// sequence of transfers from this thread is not interleaved with other
+  /// threads' transfers.  Call unlock() when done.  The lock is recursive, and
+  /// without a bus manager this does nothing.
+  void lock()
+  {
+    if (bus) { lockBus(); }
+  }
+
+  /// Releases the lock acquired with lock().
+  void unlock()
+  {
+    if (bus) { unlockBus(); }
+  }
+
+  /// Sends every frame to the specified transport instead of the SPI
+  /// peripheral, or goes back to SPI if @p transport is null.
+  ///
+  /// With a transport, the chip select pin and SPI clock speed are not used,
+  /// and asynchronous frames are sent immediately by writeRegAsync() and
+  /// readRegAsync(), which also call the asynchronous callback before
+  /// returning.  Bus locking and statistics work the same as with SPI.
+  ///
+  /// \see HPSDTransport, HPSDMockDRV8711
+  void setTransport(HPSDTransport * transport)
+  {
+    finishAsync();
+    this->transport = transport;
+  }
+
+  /// Returns the transport set with setTransport(), or null.
+  HPSDTransport * getTransport() const
+  {
+    return transport;
+  }
+
+  /// Queues a register write to be sent in the background with DMA.
+  ///
+  /// This function returns without waiting for the SPI transfer.  Frames are
+  /// sent in the order they were queued; the chip select pin is toggled
+  /// between them by the DMA completion interrupt.  Only one DRV8711SPI object
+  /// can be sending asynchronously at a time, since they share the SPI
+  /// peripheral, so this waits if another object's queue is still being sent.
+  ///
+  /// @return false if the queue is full (see #HPSD_ASYNC_QUEUE_SIZE).
+  bool writeRegAsync(uint8_t address, uint16_t value)
+  {
+    return queueAsync(((address & 0b111) << 12) | (value & 0xFFF), nullptr);
+  }
+
+  /// Queues a register write to be sent in the background with DMA.
+  bool writeRegAsync(HPSDRegAddr address, uint16_t value)
+  {
+    return writeRegAsync((uint8_t)address, value);
+  }
+
+  /// Queues a register read to be sent in the background with DMA.
+  ///
+  /// The register's value is stored in @p result when the frame has been
+  /// sent, so @p result must stay valid until isAsyncBusy() returns false.
+  ///
+  /// @return false if the queue is full (see #HPSD_ASYNC_QUEUE_SIZE).
+  bool readRegAsync(uint8_t address, volatile uint16_t * result)
+  {
+    return queueAsync((0x8 | (address & 0b111)) << 12, result);
+  }
+
+  /// Queues a register read to be sent in the background with DMA.
+  bool readRegAsync(HPSDRegAddr address, volatile uint16_t * result)
+  {
+    return readRegAsync((uint8_t)address, result);
+  }
+
+  /// Sets a function to be called from the DMA completion interrupt each time
+  /// the asynchronous queue has been completely sent.
+  void setAsyncCallback(HPSDAsyncCallback callback, void * context)
+  {
+    asyncCallback = callback;
+    asyncContext = context;
+  }
+
+  /// Returns true if queued asynchronous frames have not all been sent yet.
+  bool isAsyncBusy() const
+  {
+    return asyncBusy;
+  }
+
+#ifdef HPSD_SPI_STATS
+  /// Returns the SPI statistics collected for this driver.  This is only
+  /// available if HPSD_SPI_STATS is defined; see HPSDSpiStats.
+  HPSDSpiStats & getStats()
+  {
+    return stats;
+  }
+#endif
+
+  /// Waits for the asynchronous queue to be sent and releases the SPI bus.
+  ///
+  /// The SPI transaction used for asynchronous transfers cannot be ended from
+  /// an interrupt, so it is ended here instead.  readReg(), writeReg(), and
+  /// writeRegs() do this automatically, for this object or any other one that
+  /// is sending its queue; call it yourself if another library needs the SPI
+  /// bus after you have queued asynchronous frames.
+  void finishAsync()
+  {
+    if (!asyncTransaction) { return; }
+    while (asyncBusy) {}
+    SPI.endTransaction();
+    asyncTransaction = false;
+    if (asyncOwner == this) { asyncOwner = nullptr; }
+  }
+
 private:
 
-  SPISettings settings = SPISettings(500000, MSBFIRST, SPI_MODE0);
+  /// Ends the asynchronous transfer of whichever object is using the SPI
+  /// peripheral, so that a blocking transfer can use it.  Only that object
+  /// can hold an asynchronous transaction open.
+  static void finishAllAsync()
+  {
+    while (asyncOwner != nullptr) { asyncOwner->finishAsync(); }
+  }
+
+  friend class HPSDSpiBus;
+
+  uint32_t clockSpeed = HPSD_SPI_DEFAULT_CLOCK;
+  SPISettings settings = SPISettings(HPSD_SPI_DEFAULT_CLOCK, MSBFIRST, SPI_MODE0);
 
   uint16_t transfer(uint16_t value)
   {
@@ -104,8 +335,38 @@ private:
     return retVal;
   }
 
+  /// Sends one 16-bit frame inside a transaction that is already open.  The
+  /// CS line goes low afterwards, which latches a write.
+  uint16_t transferFrame(uint16_t value)
+  {
+    if (transport) { return transport->transfer(value); }
+    digitalWrite(csPin, HIGH);
+    uint16_t retVal = transfer(value);
+    digitalWrite(csPin, LOW);
+    return retVal;
+  }
+
+  /// Sends one frame as its own transaction.  The CS line must go low after
+  /// writing for the value to actually take effect.
+  uint16_t exchange(uint16_t value)
+  {
+    if (transport)
+    {
+      if (bus) { lockBus(); }
+      uint16_t retVal = transport->transfer(value);
+      if (bus) { unlockBus(); }
+      return retVal;
+    }
+
+    selectChip();
+    uint16_t retVal = transfer(value);
+    deselectChip();
+    return retVal;
+  }
+
   void selectChip()
   {
+    if (bus) { lockBus(); }
     digitalWrite(csPin, HIGH);
     SPI.beginTransaction(settings);
   }
@@ -114,9 +375,87 @@ private:
   {
    SPI.endTransaction();
    digitalWrite(csPin, LOW);
+   if (bus) { unlockBus(); }
   }
 
+  // Defined in HPSDSpiBus.cpp so that this header does not depend on it.
+  void lockBus();
+  void unlockBus();
+
+  bool queueAsync(uint16_t frame, volatile uint16_t * result)
+  {
+    if (transport)
+    {
+      uint16_t value = exchange(frame);
+      if (result != nullptr) { *result = value & 0xFFF; }
+      if (asyncCallback != nullptr) { asyncCallback(asyncContext); }
+      return true;
+    }
+
+    bool start = false;
+    ATOMIC_BLOCK()
+    {
+      uint8_t next = (asyncHead + 1) % HPSD_ASYNC_QUEUE_SIZE;
+      if (next == asyncTail) { return false; }
+      asyncFrames[asyncHead] = frame;
+      asyncResults[asyncHead] = result;
+      asyncHead = next;
+      if (!asyncBusy)
+      {
+        asyncBusy = true;
+        start = true;
+      }
+    }
+
+    if (start)
+    {
+      // Wait for any other object's asynchronous transfer, then hold the bus
+      // until this queue is empty.
+      while (asyncOwner != nullptr && asyncOwner != this) { asyncOwner->finishAsync(); }
+      if (!asyncTransaction)
+      {
+        SPI.beginTransaction(settings);
+        asyncTransaction = true;
+      }
+      asyncOwner = this;
+      startAsyncFrame();
+    }
+    return true;
+  }
+
+  void startAsyncFrame()
+  {
+    uint16_t frame = asyncFrames[asyncTail];
+    asyncTx[0] = frame >> 8;
+    asyncTx[1] = frame & 0xFF;
+    pinSetFast(csPin);
+    SPI.transfer(asyncTx, asyncRx, 2, asyncDmaDone);
+  }
+
+  // Called from the DMA completion interrupt of the SPI peripheral.
+  static void asyncDmaDone();
+  void asyncFrameDone();
+
+  static DRV8711SPI * volatile asyncOwner;
+
   uint8_t csPin;
+  HPSDSpiBus * bus = nullptr;
+  HPSDTransport * transport = nullptr;
+
+  uint16_t asyncFrames[HPSD_ASYNC_QUEUE_SIZE];
+  volatile uint16_t * asyncResults[HPSD_ASYNC_QUEUE_SIZE];
+  volatile uint8_t asyncHead = 0;
+  volatile uint8_t asyncTail = 0;
+  volatile bool asyncBusy = false;
+  bool asyncTransaction = false;
+  uint8_t asyncTx[2];
+  uint8_t asyncRx[2];
+  HPSDAsyncCallback asyncCallback = nullptr;
+  void * asyncContext = nullptr;
+
+#ifdef HPSD_SPI_STATS
+  HPSDSpiStats stats;
+#endif
 };
 
 
@@ -145,6 +484,96 @@ enum class HPSDDecayMode : uint8_t
   AutoMixed           = 0b101,
 };
 
+/// Possible arguments to setDeadTime() (DTIME).
+enum class HPSDDeadTime : uint8_t
+{
+  Ns400 = 0b00,
+  Ns450 = 0b01,
+  Ns650 = 0b10,
+  Ns850 = 0b11,
+};
+
+/// Possible arguments to setBemfSampleTime() (SMPLTH).
+enum class HPSDBemfSampleTime : uint8_t
+{
+  Us50   = 0b000,
+  Us100  = 0b001,
+  Us200  = 0b010,
+  Us300  = 0b011,
+  Us400  = 0b100,
+  Us600  = 0b101,
+  Us800  = 0b110,
+  Us1000 = 0b111,
+};
+
+/// Possible arguments to setOcpThreshold() (OCPTH), the voltage across a
+/// low-side or high-side MOSFET that counts as overcurrent.
+enum class HPSDOcpThreshold : uint8_t
+{
+  Mv250  = 0b00,
+  Mv500  = 0b01,
+  Mv750  = 0b10,
+  Mv1000 = 0b11,
+};
+
+/// Possible arguments to setOcpDeglitchTime() (OCPDEG).
+enum class HPSDOcpDeglitch : uint8_t
+{
+  Us1 = 0b00,
+  Us2 = 0b01,
+  Us4 = 0b10,
+  Us8 = 0b11,
+};
+
+/// Possible arguments to setGateDriveTime() (TDRIVEP and TDRIVEN).
+enum class HPSDGateDriveTime : uint8_t
+{
+  Ns250  = 0b00,
+  Ns500  = 0b01,
+  Ns1000 = 0b10,
+  Ns2000 = 0b11,
+};
+
+/// Possible arguments to setGateDriveCurrent() for the high-side source
+/// current (IDRIVEP).
+enum class HPSDSourceCurrent : uint8_t
+{
+  Ma50  = 0b00,
+  Ma100 = 0b01,
+  Ma150 = 0b10,
+  Ma200 = 0b11,
+};
+
+/// Possible arguments to setGateDriveCurrent() for the low-side sink current
+/// (IDRIVEN).
+enum class HPSDSinkCurrent : uint8_t
+{
+  Ma100 = 0b00,
+  Ma200 = 0b01,
+  Ma300 = 0b10,
+  Ma400 = 0b11,
+};
+
+/// Possible arguments to setStallDetection() for SDCNT, the number of steps
+/// the back EMF must stay below the threshold before a stall is reported.
+enum class HPSDStallCount : uint8_t
+{
+  Steps1 = 0b00,
+  Steps2 = 0b01,
+  Steps4 = 0b10,
+  Steps8 = 0b11,
+};
+
+/// Possible arguments to setStallDetection() for VDIV, the divider applied to
+/// the back EMF before it is compared to the threshold.
+enum class HPSDBemfDivider : uint8_t
+{
+  Div32 = 0b00,
+  Div16 = 0b01,
+  Div8  = 0b10,
+  Div4  = 0b11,
+};
+
 /// Bits that are set in the return value of readStatus() to indicate status
 /// conditions.
 ///
@@ -177,9 +606,381 @@ enum class HPSDStatusBit : uint8_t
   STDLAT = 7,
 };
 
+/// Possible return values of HighPowerStepperDriver::verifyNext().
+enum class HPSDVerifyResult : uint8_t
+{
+  /// The register that was checked matched its cached value (or STATUS did
+  /// not show undervoltage lockout).
+  Match,
+
+  /// The register that was checked did not match its cached value.  It will
+  /// be rewritten at the end of the pass.
+  Mismatch,
+
+  /// The pass ended, and the registers that did not match during it were
+  /// rewritten in one SPI transaction.
+  Repaired,
+
+  /// STATUS showed undervoltage lockout, so every setting was rewritten and
+  /// UVLO was cleared.
+  Undervoltage,
+};
+
+/// Bits that are set in the return value of
+/// HighPowerStepperDriver::getPinEvents() to indicate which of the driver's
+/// open-drain status outputs has signaled since the last call to
+/// HighPowerStepperDriver::serviceStatus().
+enum class HPSDPinEvent : uint8_t
+{
+  /// The FAULTn pin went low.
+  Fault = 0,
+
+  /// The STALLn pin went low.
+  Stall = 1,
+};
+
+/// A function called from the pin interrupt when FAULTn or STALLn goes low.
+/// @p event is the #HPSDPinEvent that happened.
+typedef void (*HPSDPinEventCallback)(void * context, HPSDPinEvent event);
+
+
+/// Describes a bit field within one of the DRV8711's registers.
+///
+/// All of the functions are constexpr, so settings built from these
+/// descriptors with constant arguments are computed by the compiler.
+struct HPSDField
+{
+  HPSDRegAddr address;
+  uint8_t shift;
+  uint8_t width;
+
+  /// Returns the bits of the register occupied by the field.
+  constexpr uint16_t mask() const
+  {
+    return ((1 << width) - 1) << shift;
+  }
+
+  /// Returns @p value shifted into the field's position.  Bits that do not fit
+  /// in the field are dropped.
+  constexpr uint16_t encode(uint16_t value) const
+  {
+    return (value << shift) & mask();
+  }
+
+  /// Returns @p word with the field replaced by @p value.
+  constexpr uint16_t insert(uint16_t word, uint16_t value) const
+  {
+    return (word & ~mask()) | encode(value);
+  }
+
+  /// Returns the value of the field in @p word.
+  constexpr uint16_t extract(uint16_t word) const
+  {
+    return (word & mask()) >> shift;
+  }
+};
+
+/// Descriptors for the fields of the DRV8711's settings registers, named as
+/// in the datasheet.
+namespace HPSDRegs
+{
+  constexpr HPSDField ENBL    = { HPSDRegAddr::CTRL,   0,  1 };
+  constexpr HPSDField RDIR    = { HPSDRegAddr::CTRL,   1,  1 };
+  constexpr HPSDField RSTEP   = { HPSDRegAddr::CTRL,   2,  1 };
+  constexpr HPSDField MODE    = { HPSDRegAddr::CTRL,   3,  4 };
+  constexpr HPSDField EXSTALL = { HPSDRegAddr::CTRL,   7,  1 };
+  constexpr HPSDField ISGAIN  = { HPSDRegAddr::CTRL,   8,  2 };
+  constexpr HPSDField DTIME   = { HPSDRegAddr::CTRL,  10,  2 };
+
+  constexpr HPSDField TORQUE  = { HPSDRegAddr::TORQUE, 0,  8 };
+  constexpr HPSDField SMPLTH  = { HPSDRegAddr::TORQUE, 8,  3 };
+
+  constexpr HPSDField TOFF    = { HPSDRegAddr::OFF,    0,  8 };
+  constexpr HPSDField PWMMODE = { HPSDRegAddr::OFF,    8,  1 };
+
+  constexpr HPSDField TBLANK  = { HPSDRegAddr::BLANK,  0,  8 };
+  constexpr HPSDField ABT     = { HPSDRegAddr::BLANK,  8,  1 };
+
+  constexpr HPSDField TDECAY  = { HPSDRegAddr::DECAY,  0,  8 };
+  constexpr HPSDField DECMOD  = { HPSDRegAddr::DECAY,  8,  3 };
+
+  constexpr HPSDField SDTHR   = { HPSDRegAddr::STALL,  0,  8 };
+  constexpr HPSDField SDCNT   = { HPSDRegAddr::STALL,  8,  2 };
+  constexpr HPSDField VDIV    = { HPSDRegAddr::STALL, 10,  2 };
+
+  constexpr HPSDField OCPTH   = { HPSDRegAddr::DRIVE,  0,  2 };
+  constexpr HPSDField OCPDEG  = { HPSDRegAddr::DRIVE,  2,  2 };
+  constexpr HPSDField TDRIVEN = { HPSDRegAddr::DRIVE,  4,  2 };
+  constexpr HPSDField TDRIVEP = { HPSDRegAddr::DRIVE,  6,  2 };
+  constexpr HPSDField IDRIVEN = { HPSDRegAddr::DRIVE,  8,  2 };
+  constexpr HPSDField IDRIVEP = { HPSDRegAddr::DRIVE, 10,  2 };
+
+  /// Power-on default values of the settings registers.
+  constexpr uint16_t CTRL_DEFAULT   = 0xC10;
+  constexpr uint16_t TORQUE_DEFAULT = 0x1FF;
+  constexpr uint16_t OFF_DEFAULT    = 0x030;
+  constexpr uint16_t BLANK_DEFAULT  = 0x080;
+  constexpr uint16_t DECAY_DEFAULT  = 0x110;
+  constexpr uint16_t STALL_DEFAULT  = 0x040;
+  constexpr uint16_t DRIVE_DEFAULT  = 0xA59;
+
+  /// Returns the MODE field value for a number of microsteps per full step,
+  /// which is log2 of it.  Anything other than a power of two from 1 to 256
+  /// selects 1/4 micro-step, the driver's default.
+  constexpr uint8_t modeBits(uint16_t microsteps, uint8_t bits = 0)
+  {
+    return (microsteps == 0 || microsteps > 256 || (microsteps & (microsteps - 1))) ? 2 :
+      microsteps == 1 ? bits : modeBits(microsteps >> 1, bits + 1);
+  }
+}
+
+/// Describes a High-Power Stepper Motor Driver board by its current sense
+/// resistance (in milliohms) and the highest current limit it supports (in
+/// milliamps), and computes ISGAIN and TORQUE values for it.
+///
+/// All of the computation is constexpr, so it can happen at compile time for
+/// constant currents, and at run time it takes one multiplication, one
+/// division by a constant (which the compiler turns into a multiplication), a
+/// count-leading-zeros instruction, and a few shifts, with no loops or
+/// branches.
+///
+/// HPSD36v4 describes the High-Power Stepper Motor Driver 36v4.  For another
+/// DRV8711-based board, define its traits the same way:
+/// ~~~{.cpp}
+/// typedef HPSDBoard<25, 10000> MyBoard;
+/// sd.setCurrentMilliamps<MyBoard>(3000);
+/// ~~~
+template <uint16_t SenseMilliohms, uint16_t MaxCurrentMilliamps> struct HPSDBoard
+{
+  /// The current sense resistance in milliohms.
+  static constexpr uint16_t SenseResistanceMilliohms = SenseMilliohms;
+
+  /// The highest current limit, in milliamps, that the current functions
+  /// will set; higher arguments are limited to this.
+  static constexpr uint16_t MaxCurrent = MaxCurrentMilliamps;
+
+  /// Returns @p current limited to MaxCurrent.
+  static constexpr uint16_t limit(uint16_t current)
+  {
+    return current > MaxCurrent ? MaxCurrent : current;
+  }
+
+  /// Returns the TORQUE value that, with ISGAIN = 40, gives a full-scale
+  /// current of @p current milliamps.
+  ///
+  /// From the DRV8711 datasheet, section 7.3.4, equation 2:
+  ///
+  ///   Ifs = (2.75 V * TORQUE) / (256 * ISGAIN * Risense)
+  ///
+  /// Rearranged, with Risense in milliohms and the current in milliamps:
+  ///
+  ///   TORQUE = (256 * 40 * Risense * current) / 2750000000
+  ///          = (128 * Risense * current) / 34375
+  static constexpr uint32_t torqueAtGain40(uint16_t current)
+  {
+    return ((uint32_t)128 * SenseMilliohms * limit(current)) / 34375;
+  }
+
+  /// Returns the number of times the gain must be halved from 40 so that the
+  /// TORQUE value @p torque40 (from torqueAtGain40()) fits in 8 bits.  This is
+  /// the number of bits it has beyond 8.
+  static constexpr uint8_t gainShift(uint32_t torque40)
+  {
+    return shiftFromExcessBits(32 - __builtin_clz(torque40 | 1) - 8);
+  }
+
+  /// Returns the ISGAIN field value for @p current milliamps: the highest gain
+  /// (5, 10, 20, or 40) that does not overflow TORQUE.
+  static constexpr uint8_t isgainBits(uint16_t current)
+  {
+    return 3 - gainShift(torqueAtGain40(current));
+  }
+
+  /// Returns the TORQUE field value for @p current milliamps with the gain
+  /// from isgainBits().
+  static constexpr uint8_t torqueBits(uint16_t current)
+  {
+    return torqueAtGain40(current) >> gainShift(torqueAtGain40(current));
+  }
+
+  /// Returns the TORQUE field value for @p current milliamps with the gain
+  /// fixed at @p isgain (an ISGAIN field value), limited to 0xFF.
+  static constexpr uint8_t torqueBitsAtGain(uint16_t current, uint8_t isgain)
+  {
+    return (torqueAtGain40(current) >> (3 - isgain)) > 0xFF ? 0xFF :
+      torqueAtGain40(current) >> (3 - isgain);
+  }
+
+  static_assert(((uint32_t)128 * SenseMilliohms * MaxCurrentMilliamps) / 34375 <= 0x7FF,
+    "MaxCurrentMilliamps is beyond what the DRV8711 can regulate with this resistance.");
+
+private:
+  // max(excess, 0) without a branch.
+  static constexpr uint8_t shiftFromExcessBits(int excess)
+  {
+    return excess & ~(excess >> 31);
+  }
+};
+
+/// Board traits for the High-Power Stepper Motor Driver 36v4, which has a
+/// current sense resistance of 30 milliohms.  See
+/// HighPowerStepperDriver::setCurrentMilliamps36v4() before going above 4 A.
+typedef HPSDBoard<30, 8000> HPSD36v4;
+
+/// A complete set of values for the DRV8711's seven settings registers.
+///
+/// HPSDConfig is a constexpr value type: each function returns a modified
+/// copy, so a full configuration can be built as a compile-time constant and
+/// then written to the driver in one batch with
+/// HighPowerStepperDriver::applyConfig().
+///
+/// Example usage:
+/// ~~~{.cpp}
+/// constexpr HPSDConfig MotorConfig = HPSDConfig()
+///   .stepMode(HPSDStepMode::MicroStep32)
+///   .currentMilliamps36v4(1000)
+///   .decayMode(HPSDDecayMode::AutoMixed);
+///
+/// void setup()
+/// {
+///   sd.applyConfig(MotorConfig);
+///   sd.enableDriver();
+/// }
+/// ~~~
+class HPSDConfig
+{
+public:
+  /// Creates a configuration with the driver's power-on defaults.
+  constexpr HPSDConfig()
+    : HPSDConfig(HPSDRegs::CTRL_DEFAULT, HPSDRegs::TORQUE_DEFAULT,
+      HPSDRegs::OFF_DEFAULT, HPSDRegs::BLANK_DEFAULT, HPSDRegs::DECAY_DEFAULT,
+      HPSDRegs::STALL_DEFAULT, HPSDRegs::DRIVE_DEFAULT)
+  {
+  }
+
+  constexpr HPSDConfig(uint16_t ctrl, uint16_t torque, uint16_t off,
+    uint16_t blank, uint16_t decay, uint16_t stall, uint16_t drive)
+    : ctrl(ctrl), torque(torque), off(off), blank(blank), decay(decay),
+      stall(stall), drive(drive)
+  {
+  }
+
+  /// Returns a copy with the specified field set to @p value.
+  constexpr HPSDConfig with(HPSDField field, uint16_t value) const
+  {
+    return HPSDConfig(
+      field.address == HPSDRegAddr::CTRL   ? field.insert(ctrl, value)   : ctrl,
+      field.address == HPSDRegAddr::TORQUE ? field.insert(torque, value) : torque,
+      field.address == HPSDRegAddr::OFF    ? field.insert(off, value)    : off,
+      field.address == HPSDRegAddr::BLANK  ? field.insert(blank, value)  : blank,
+      field.address == HPSDRegAddr::DECAY  ? field.insert(decay, value)  : decay,
+      field.address == HPSDRegAddr::STALL  ? field.insert(stall, value)  : stall,
+      field.address == HPSDRegAddr::DRIVE  ? field.insert(drive, value)  : drive);
+  }
+
+  /// Returns a copy with the stepping mode (MODE) set.
+  constexpr HPSDConfig stepMode(HPSDStepMode mode) const
+  {
+    return with(HPSDRegs::MODE, HPSDRegs::modeBits((uint16_t)mode));
+  }
+
+  /// Returns a copy with ISGAIN and TORQUE set for a current limit of
+  /// @p current milliamps on the board described by @p Board (see
+  /// HPSDBoard).
+  template <class Board> constexpr HPSDConfig currentMilliamps(uint16_t current) const
+  {
+    return with(HPSDRegs::ISGAIN, Board::isgainBits(current))
+      .with(HPSDRegs::TORQUE, Board::torqueBits(current));
+  }
+
+  /// Returns a copy with ISGAIN and TORQUE set for a current limit of
+  /// @p current milliamps on a High-Power Stepper Motor Driver 36v4.  See
+  /// HighPowerStepperDriver::setCurrentMilliamps36v4().
+  constexpr HPSDConfig currentMilliamps36v4(uint16_t current) const
+  {
+    return currentMilliamps<HPSD36v4>(current);
+  }
+
+  /// Returns a copy with the decay mode (DECMOD) set.
+  constexpr HPSDConfig decayMode(HPSDDecayMode mode) const
+  {
+    return with(HPSDRegs::DECMOD, (uint8_t)mode);
+  }
+
+  /// Returns a copy with the fixed off time (TOFF) set, in units of 500 ns.
+  constexpr HPSDConfig offTime(uint8_t toff) const
+  {
+    return with(HPSDRegs::TOFF, toff);
+  }
+
+  /// Returns a copy with the current trip blanking time (TBLANK) set, in
+  /// units of 20 ns.
+  constexpr HPSDConfig blankTime(uint8_t tblank) const
+  {
+    return with(HPSDRegs::TBLANK, tblank);
+  }
+
+  /// Returns a copy with the mixed decay transition time (TDECAY) set, in
+  /// units of 500 ns.
+  constexpr HPSDConfig decayTime(uint8_t tdecay) const
+  {
+    return with(HPSDRegs::TDECAY, tdecay);
+  }
+
+  /// Returns a copy with the direction (RDIR) set.
+  constexpr HPSDConfig direction(bool value) const
+  {
+    return with(HPSDRegs::RDIR, value);
+  }
+
+  /// Returns a copy with the driver enabled (ENBL = 1) or disabled.
+  constexpr HPSDConfig enabled(bool value) const
+  {
+    return with(HPSDRegs::ENBL, value);
+  }
+
+  /// Returns the value of the specified register.  STATUS reads as 0.
+  constexpr uint16_t word(HPSDRegAddr address) const
+  {
+    return address == HPSDRegAddr::CTRL   ? ctrl   :
+           address == HPSDRegAddr::TORQUE ? torque :
+           address == HPSDRegAddr::OFF    ? off    :
+           address == HPSDRegAddr::BLANK  ? blank  :
+           address == HPSDRegAddr::DECAY  ? decay  :
+           address == HPSDRegAddr::STALL  ? stall  :
+           address == HPSDRegAddr::DRIVE  ? drive  : 0;
+  }
+
+  uint16_t ctrl, torque, off, blank, decay, stall, drive;
+};
+
 
 /// This class provides high-level functions for controlling a DRV8711-based
 /// High-Power Stepper Motor Driver.
+///
+/// \section hpsd_threads Threads
+///
+/// With `SYSTEM_THREAD(ENABLED)`, the setters can be called from more than
+/// one thread (for example, the application loop and a cloud function
+/// handler) as long as the driver is attached to an HPSDSpiBus, which
+/// provides the lock that SPI access needs:
+///
+/// - Each setter changes its fields in the cached registers with a
+///   read-modify-write inside an `ATOMIC_BLOCK()`, which lasts well under a
+///   microsecond, so two setters changing different fields of the same
+///   register (such as setDirection() and setStepMode() in CTRL) cannot
+///   lose each other's changes.
+/// - Writing registers to the device holds the bus lock for the one SPI
+///   transaction, and the cached values are copied while holding it, so the
+///   device always ends up with the latest cached values.  The lock is not
+///   held while computing settings or between calls.
+///
+/// setCurrentMilliamps() changes two registers, so another thread's write
+/// can briefly send the new ISGAIN with the old TORQUE.  beginUpdate() and
+/// commit() share one nesting count for all threads, so a group started on
+/// one thread also defers other threads' writes until it is committed.  The
+/// verification functions (verifySettings(), verifyNext()) should only be
+/// called from one thread.
 class HighPowerStepperDriver
 {
 public:
@@ -187,13 +988,8 @@ public:
   HighPowerStepperDriver()
   {
     // All settings set to power-on defaults
-    ctrl   = 0xC10;
-    torque = 0x1FF;
-    off    = 0x030;
-    blank  = 0x080;
-    decay  = 0x110;
-    stall  = 0x040;
-    drive  = 0xA59;
+    loadConfig(HPSDConfig());
+    dirty = 0;
   }
 
   /// Configures this object to use the specified pin as a chip select pin.
@@ -203,6 +999,41 @@ public:
     driver.setChipSelectPin(pin);
   }
 
+  /// Tells the library which pins are connected to the driver's STEP and DIR
+  /// inputs, and drives them low.  Pass #HPSD_NO_PIN for a pin that is not
+  /// connected.
+  ///
+  /// These pins are used by HPSDStepEngine::begin(HighPowerStepperDriver &),
+  /// which generates the step pulses and the DIR setup time with a hardware
+  /// timer and fast GPIO instead of busy waits.
+  void setStepDirPins(uint8_t stepPin, uint8_t dirPin = HPSD_NO_PIN)
+  {
+    this->stepPin = stepPin;
+    this->dirPin = dirPin;
+    if (stepPin != HPSD_NO_PIN)
+    {
+      pinMode(stepPin, OUTPUT);
+      pinResetFast(stepPin);
+    }
+    if (dirPin != HPSD_NO_PIN)
+    {
+      pinMode(dirPin, OUTPUT);
+      pinResetFast(dirPin);
+    }
+  }
+
+  /// Returns the STEP pin set with setStepDirPins(), or #HPSD_NO_PIN.
+  uint8_t getStepPin() const
+  {
+    return stepPin;
+  }
+
+  /// Returns the DIR pin set with setStepDirPins(), or #HPSD_NO_PIN.
+  uint8_t getDirPin() const
+  {
+    return dirPin;
+  }
+
   /// Changes all of the driver's settings back to their default values.
   ///
   /// It is good to call this near the beginning of your program to ensure that
@@ -210,72 +1041,249 @@ public:
   /// operation of the driver.
   void resetSettings()
   {
-    ctrl   = 0xC10;
-    torque = 0x1FF;
-    off    = 0x030;
-    blank  = 0x080;
-    decay  = 0x110;
-    stall  = 0x040;
-    drive  = 0xA59;
+    applyConfig(HPSDConfig());
+  }
+
+  /// Replaces all of the driver's settings with the specified configuration
+  /// and writes them to the device in a single SPI transaction.
+  ///
+  /// \see HPSDConfig
+  void applyConfig(const HPSDConfig & config)
+  {
+    loadConfig(config);
     applySettings();
   }
 
+  /// Returns the cached settings as an HPSDConfig.  This does not perform any
+  /// SPI communication with the driver.
+  HPSDConfig getConfig() const
+  {
+    return HPSDConfig(ctrl, torque, off, blank, decay, stall, drive);
+  }
+
   /// Reads back the SPI configuration registers from the device and verifies
   /// that they are equal to the cached copies stored in this class.
   ///
   /// This can be used to verify that the driver is powered on and has not lost
   /// them due to a power failure.  The STATUS register is not verified because
-  /// it does not contain any driver settings.
+  /// it does not contain any driver settings.  To check periodically without
+  /// blocking for seven reads, see verifyNext().
   ///
   /// @return 1 if the settings from the device match the cached copies, 0 if
   /// they do not.
   bool verifySettings()
   {
-    // Bit 10 in TORQUE is write-only and will always read as 0.
-    return driver.readReg(HPSDRegAddr::CTRL)   == ctrl   &&
-           driver.readReg(HPSDRegAddr::TORQUE) == (torque & ~(1 << 10)) &&
-           driver.readReg(HPSDRegAddr::OFF)    == off    &&
-           driver.readReg(HPSDRegAddr::BLANK)  == blank  &&
-           driver.readReg(HPSDRegAddr::DECAY)  == decay  &&
-           driver.readReg(HPSDRegAddr::STALL)  == stall  &&
-           driver.readReg(HPSDRegAddr::DRIVE)  == drive;
+    for (uint8_t i = 0; i < 7; i++)
+    {
+      if (!registerMatches((HPSDRegAddr)i)) { return false; }
+    }
+    return true;
+  }
+
+  /// Does one step of an incremental verification of the driver's settings,
+  /// which costs a single SPI frame.
+  ///
+  /// This spreads the work of verifySettings() over several calls so that it
+  /// can run every control tick without blocking for long.  A pass takes
+  /// eight calls:
+  ///
+  /// 1. STATUS is read.  If undervoltage lockout is latched, the device has
+  ///    probably been reset, so reading the settings back is skipped: they
+  ///    are all rewritten with applySettings(), UVLO is cleared, and a new
+  ///    pass begins.
+  /// 2. Each of the seven settings registers is read back on its own call,
+  ///    starting with CTRL, and compared with its cached value.  Registers
+  ///    with unwritten changes (inside beginUpdate()) are not compared.
+  ///
+  /// At the end of the pass, the registers that did not match are rewritten
+  /// together in one SPI transaction.
+  ///
+  /// Note that rewriting CTRL restores the cached ENBL bit, so a driver that
+  /// was enabled before a brownout is enabled again.
+  ///
+  /// If @p repair is false, nothing is written: Undervoltage and Mismatch
+  /// results are left for the caller to handle (HPSDBrownoutRecovery does
+  /// this), and while UVLO stays latched every call reads STATUS again.
+  HPSDVerifyResult verifyNext(bool repair = true)
+  {
+    uint8_t slot = verifySlot;
+    verifySlot = (slot + 1) & 0b111;
+
+    if (slot == 0)
+    {
+      verifyMismatches = 0;
+      if (!(readStatus() & (1 << (uint8_t)HPSDStatusBit::UVLO)))
+      {
+        return HPSDVerifyResult::Match;
+      }
+      if (!repair)
+      {
+        verifySlot = 0;
+        return HPSDVerifyResult::Undervoltage;
+      }
+      applySettings();
+      driver.writeReg(HPSDRegAddr::STATUS, ~(1 << (uint8_t)HPSDStatusBit::UVLO));
+      return HPSDVerifyResult::Undervoltage;
+    }
+
+    HPSDRegAddr address = (HPSDRegAddr)(slot - 1);
+    HPSDVerifyResult result = HPSDVerifyResult::Match;
+    if (!(dirty & (1 << (uint8_t)address)) && !registerMatches(address))
+    {
+      if (repair) { verifyMismatches |= 1 << (uint8_t)address; }
+      result = HPSDVerifyResult::Mismatch;
+    }
+
+    if (address == HPSDRegAddr::DRIVE && verifyMismatches)
+    {
+      writeRegisters(verifyMismatches);
+      verifyMismatches = 0;
+      result = HPSDVerifyResult::Repaired;
+    }
+    return result;
+  }
+
+  /// Makes the next call to verifyNext() start a new pass, forgetting any
+  /// mismatches found so far.
+  void restartVerify()
+  {
+    verifySlot = 0;
+    verifyMismatches = 0;
+  }
+
+  /// Finds the fastest SPI clock that works reliably with this driver and
+  /// selects it.
+  ///
+  /// Starting at @p maxHz, this function tries successively halved clock
+  /// frequencies down to #HPSD_SPI_DEFAULT_CLOCK.  At each one, it writes test
+  /// patterns to the STALL register, reads them back, restores STALL, and
+  /// checks verifySettings(), repeating this @p trials times.  It settles on
+  /// the first frequency at which every check passes.
+  ///
+  /// The STALL register only affects stall detection, but the STALLn output
+  /// might toggle while the test runs, so it is best to call this before
+  /// enabling the driver.
+  ///
+  /// @return The selected clock frequency in Hz, or 0 if no frequency passed
+  /// (in which case the previous frequency is kept).
+  uint32_t tuneClockSpeed(uint32_t maxHz = HPSD_SPI_MAX_CLOCK, uint8_t trials = 8)
+  {
+    const uint16_t patterns[] = { 0xAAA, 0x555, 0xFFF, 0x000 };
+    uint32_t previousHz = driver.getClockSpeed();
+
+    for (uint32_t hz = maxHz; hz >= HPSD_SPI_DEFAULT_CLOCK; hz /= 2)
+    {
+      driver.setClockSpeed(hz);
+
+      bool pass = true;
+      for (uint8_t trial = 0; pass && trial < trials; trial++)
+      {
+        for (uint8_t i = 0; pass && i < sizeof(patterns) / sizeof(patterns[0]); i++)
+        {
+          driver.writeReg(HPSDRegAddr::STALL, patterns[i]);
+          pass = driver.readReg(HPSDRegAddr::STALL) == patterns[i];
+        }
+        driver.writeReg(HPSDRegAddr::STALL, stall);
+        pass = pass && verifySettings();
+      }
+
+      if (pass) { return hz; }
+    }
+
+    driver.setClockSpeed(previousHz);
+    driver.writeReg(HPSDRegAddr::STALL, stall);
+    return 0;
+  }
+
+  /// Re-writes the cached settings stored in this class to the device.
+  ///
+  /// You should not normally need to call this function because settings are
+  /// written to the device whenever they change.  (Setters skip the SPI write
+  /// when the cached value is already correct, so calling them again does not
+  /// repair a device that lost its settings.)  However, if
+  /// verifySettings() returns false (due to a power interruption, for
+  /// instance), then you could use applySettings() to get the device's settings
+  /// back into the desired state.
+  void applySettings()
+  {
+#ifdef HPSD_SPI_STATS
+    driver.getStats().applySettingsCount++;
+#endif
+    writeRegisters(AllRegisters);
+    verifyMismatches = 0;
+  }
+
+#ifdef HPSD_SPI_STATS
+  /// Returns the SPI statistics collected for this driver.  This is only
+  /// available if HPSD_SPI_STATS is defined; see HPSDSpiStats.
+  HPSDSpiStats & getSpiStats()
+  {
+    return driver.getStats();
+  }
+#endif
+
+  /// Starts a group of setting changes.
+  ///
+  /// Until commit() is called, setters such as setDirection() and
+  /// setStepMode() only update the cached register values.  commit() then
+  /// writes every register that changed in a single SPI transaction.  Calls can
+  /// be nested; the registers are written by the outermost commit().
+  ///
+  /// Example usage:
+  /// ~~~{.cpp}
+  /// sd.beginUpdate();
+  /// sd.setDecayMode(HPSDDecayMode::AutoMixed);
+  /// sd.setStepMode(HPSDStepMode::MicroStep32);
+  /// sd.setDirection(1);
+  /// sd.commit();  // One SPI transaction: DECAY, then CTRL.
+  /// ~~~
+  void beginUpdate()
+  {
+    ATOMIC_BLOCK()
+    {
+      updateDepth++;
+    }
+  }
+
+  /// Writes the registers changed since beginUpdate().  See beginUpdate().
+  void commit()
+  {
+    bool outermost;
+    ATOMIC_BLOCK()
+    {
+      outermost = updateDepth == 0 || --updateDepth == 0;
+    }
+    if (!outermost) { return; }
+    writeRegisters(dirty);
   }
 
-  /// Re-writes the cached settings stored in this class to the device.
-  ///
-  /// You should not normally need to call this function because settings are
-  /// written to the device whenever they are changed.  However, if
-  /// verifySettings() returns false (due to a power interruption, for
-  /// instance), then you could use applySettings() to get the device's settings
-  /// back into the desired state.
-  void applySettings()
+  /// Returns a bitmask with one bit (1 << address) for each register whose
+  /// cached value has changed but has not been written to the device yet.
+  uint8_t getDirtyRegisters() const
   {
-    writeTORQUE();
-    writeOFF();
-    writeBLANK();
-    writeDECAY();
-    writeDRIVE();
-    writeSTALL();
-
-    // CTRL is written last because it contains the ENBL bit, and we want to try
-    // to have all the other settings correct first.  (For example, TORQUE
-    // defaults to 0xFF (the maximum value), so it would be better to set a more
-    // appropriate value if necessary before enabling the motor.)
-    writeCTRL();
+    return dirty;
   }
 
   /// Enables the driver (ENBL = 1).
   void enableDriver()
   {
-    ctrl |= (1 << 0);
-    writeCTRL();
+    modifyField(HPSDRegs::ENBL, 1);
+    flush();
   }
 
   /// Disables the driver (ENBL = 0).
   void disableDriver()
   {
-    ctrl &= ~(1 << 0);
-    writeCTRL();
+    modifyField(HPSDRegs::ENBL, 0);
+    flush();
+  }
+
+  /// Returns the cached value of ENBL.
+  ///
+  /// This does not perform any SPI communication with the driver.
+  bool getEnabled()
+  {
+    return HPSDRegs::ENBL.extract(ctrl);
   }
 
   /// Sets the motor direction (RDIR).
@@ -286,15 +1294,8 @@ public:
   /// leave the DIR pin disconnected.
   void setDirection(bool value)
   {
-    if (value)
-    {
-      ctrl |= (1 << 1);
-    }
-    else
-    {
-      ctrl &= ~(1 << 1);
-    }
-    writeCTRL();
+    modifyField(HPSDRegs::RDIR, value);
+    flush();
   }
 
   /// Returns the cached value of the motor direction (RDIR).
@@ -302,7 +1303,7 @@ public:
   /// This does not perform any SPI communication with the driver.
   bool getDirection()
   {
-    return ctrl >> 1 & 1;
+    return HPSDRegs::RDIR.extract(ctrl);
   }
 
   /// Advances the indexer by one step (RSTEP = 1).
@@ -313,7 +1314,9 @@ public:
   /// The driver automatically clears the RSTEP bit after it is written.
   void step()
   {
-    driver.writeReg(HPSDRegAddr::CTRL, ctrl | (1 << 2));
+    driver.lock();
+    driver.writeReg(HPSDRegAddr::CTRL, HPSDRegs::RSTEP.insert(ctrl, 1));
+    driver.unlock();
   }
 
   /// Sets the driver's stepping mode (MODE).
@@ -331,24 +1334,8 @@ public:
   /// ~~~
   void setStepMode(HPSDStepMode mode)
   {
-    // Pick 1/4 micro-step by default.
-    uint8_t sm = 0b0010;
-
-    switch (mode)
-    {
-    case HPSDStepMode::MicroStep1:   sm = 0b0000; break;
-    case HPSDStepMode::MicroStep2:   sm = 0b0001; break;
-    case HPSDStepMode::MicroStep4:   sm = 0b0010; break;
-    case HPSDStepMode::MicroStep8:   sm = 0b0011; break;
-    case HPSDStepMode::MicroStep16:  sm = 0b0100; break;
-    case HPSDStepMode::MicroStep32:  sm = 0b0101; break;
-    case HPSDStepMode::MicroStep64:  sm = 0b0110; break;
-    case HPSDStepMode::MicroStep128: sm = 0b0111; break;
-    case HPSDStepMode::MicroStep256: sm = 0b1000; break;
-    }
-
-    ctrl = (ctrl & 0b111110000111) | (sm << 3);
-    writeCTRL();
+    modifyField(HPSDRegs::MODE, HPSDRegs::modeBits((uint16_t)mode));
+    flush();
   }
 
   /// Sets the driver's stepping mode (MODE).
@@ -366,6 +1353,28 @@ public:
     setStepMode((HPSDStepMode)mode);
   }
 
+  /// Sets MODE to @p modeBits and sends CTRL right away as one SPI frame,
+  /// even inside beginUpdate(), for changing the step mode between two steps
+  /// (see HPSDStepModeSwitcher).
+  ///
+  /// @p modeBits is a MODE field value, such as
+  /// `HPSDRegs::modeBits(4)`, so that the conversion from a step mode can be
+  /// done in advance.  Any other changes to CTRL that are waiting for
+  /// commit() are sent too, so commit() does not write CTRL again.
+  void writeStepMode(uint8_t modeBits)
+  {
+    uint16_t value;
+    driver.lock();
+    ATOMIC_BLOCK()
+    {
+      ctrl = (ctrl & ~HPSDRegs::MODE.mask()) | HPSDRegs::MODE.encode(modeBits);
+      value = ctrl;
+      dirty &= ~(1 << (uint8_t)HPSDRegAddr::CTRL);
+    }
+    driver.writeReg(HPSDRegAddr::CTRL, value);
+    driver.unlock();
+  }
+
   /// Sets the current limit for a High-Power Stepper Motor Driver 36v4.
   ///
   /// The argument to this function should be the desired current limit in
@@ -385,39 +1394,84 @@ public:
   /// TORQUE to get the desired current limit.
   void setCurrentMilliamps36v4(uint16_t current)
   {
-    if (current > 8000) { current = 8000; }
-
-    // From the DRV8711 datasheet, section 7.3.4, equation 2:
-    //
-    //   Ifs = (2.75 V * TORQUE) / (256 * ISGAIN * Risense)
-    //
-    // Rearranged:
-    //
-    //   TORQUE = (256 * ISGAIN * Risense * Ifs) / 2.75 V
-    //
-    // The 36v4 has an Risense of 30 milliohms, and "current" is in milliamps,
-    // so:
-    //
-    //   TORQUE = (256 * ISGAIN * (30/1000) ohms * (current/1000) A) / 2.75 V
-    //          = (7680 * ISGAIN * current) / 2750000
-    //
-    // We want to pick the highest gain (5, 10, 20, or 40) that will not
-    // overflow TORQUE (8 bits, 0xFF max), so we start with a gain of 40 and
-    // calculate the TORQUE value needed.
-    uint8_t isgainBits = 0b11;
-    uint16_t torqueBits = ((uint32_t)768  * current) / 6875;
-
-    // Halve the gain and TORQUE until the TORQUE value fits in 8 bits.
-    while (torqueBits > 0xFF)
-    {
-      isgainBits--;
-      torqueBits >>= 1;
-    }
+    setCurrentMilliamps<HPSD36v4>(current);
+  }
+
+  /// Sets the current limit for the board described by @p Board (see
+  /// HPSDBoard) to @p current milliamps, limited to Board::MaxCurrent.
+  ///
+  /// This picks the highest gain (5, 10, 20, or 40) that will not overflow
+  /// TORQUE (8 bits, 0xFF max) and sets ISGAIN and TORQUE accordingly.  CTRL
+  /// is only written if the gain changes.
+  ///
+  /// Example usage:
+  /// ~~~{.cpp}
+  /// sd.setCurrentMilliamps<HPSD36v4>(2000);
+  /// ~~~
+  template <class Board> void setCurrentMilliamps(uint16_t current)
+  {
+    uint32_t torque40 = Board::torqueAtGain40(current);
+    uint8_t shift = Board::gainShift(torque40);
+    modifyField(HPSDRegs::ISGAIN, 3 - shift);
+    modifyField(HPSDRegs::TORQUE, torque40 >> shift);
+    flush();
+  }
+
+  /// Configures the driver's back-EMF stall detection (STALL register).
+  ///
+  /// A stall is reported when the back EMF, scaled by @p divider (VDIV),
+  /// stays below @p threshold (SDTHR) for @p count steps (SDCNT).  The STALLn
+  /// pin goes low and the STD and STDLAT bits of STATUS are set.  This also
+  /// selects the internal stall detector for STALLn (EXSTALL = 0).
+  ///
+  /// Back-EMF stall detection only works reliably at constant speed, above a
+  /// motor-dependent minimum; see the DRV8711 datasheet.
+  void setStallDetection(uint8_t threshold, HPSDStallCount count = HPSDStallCount::Steps1,
+    HPSDBemfDivider divider = HPSDBemfDivider::Div32)
+  {
+    beginUpdate();
+    modifyReg(HPSDRegAddr::STALL,
+      HPSDRegs::SDTHR.mask() | HPSDRegs::SDCNT.mask() | HPSDRegs::VDIV.mask(),
+      HPSDRegs::SDTHR.encode(threshold) | HPSDRegs::SDCNT.encode((uint8_t)count) |
+      HPSDRegs::VDIV.encode((uint8_t)divider));
+    modifyField(HPSDRegs::EXSTALL, 0);
+    commit();
+  }
+
+  /// Returns the cached stall detection threshold (SDTHR).
+  ///
+  /// This does not perform any SPI communication with the driver.
+  uint8_t getStallThreshold() const
+  {
+    return HPSDRegs::SDTHR.extract(stall);
+  }
+
+  /// Sets the TORQUE field of the TORQUE register, leaving ISGAIN alone.
+  ///
+  /// This changes the current limit in proportion to @p torqueBits with a
+  /// single register write, which is useful for switching between current
+  /// levels computed in advance with the same ISGAIN (see
+  /// HPSDBoard::torqueBitsAtGain()).
+  void setTorque(uint8_t torqueBits)
+  {
+    modifyField(HPSDRegs::TORQUE, torqueBits);
+    flush();
+  }
 
-    ctrl = (ctrl & 0b110011111111) | (isgainBits << 8);
-    writeCTRL();
-    torque = (torque & 0b111100000000) | torqueBits;
-    writeTORQUE();
+  /// Returns the cached value of the TORQUE field.
+  ///
+  /// This does not perform any SPI communication with the driver.
+  uint8_t getTorque() const
+  {
+    return HPSDRegs::TORQUE.extract(torque);
+  }
+
+  /// Returns the cached value of the ISGAIN field.
+  ///
+  /// This does not perform any SPI communication with the driver.
+  uint8_t getGain() const
+  {
+    return HPSDRegs::ISGAIN.extract(ctrl);
   }
 
   /// Sets the driver's decay mode (DECMOD).
@@ -428,8 +1482,211 @@ public:
   /// ~~~
   void setDecayMode(HPSDDecayMode mode)
   {
-    decay = (decay & 0b00011111111) | (((uint8_t)mode & 0b111) << 8);
-    writeDECAY();
+    modifyField(HPSDRegs::DECMOD, (uint8_t)mode);
+    flush();
+  }
+
+  /// Returns the cached stepping mode (MODE) as a number of microsteps per
+  /// full step.
+  ///
+  /// This does not perform any SPI communication with the driver.
+  uint16_t getStepMode() const
+  {
+    return 1 << HPSDRegs::MODE.extract(ctrl);
+  }
+
+  /// Returns the cached decay mode (DECMOD).
+  ///
+  /// This does not perform any SPI communication with the driver.
+  HPSDDecayMode getDecayMode() const
+  {
+    return (HPSDDecayMode)HPSDRegs::DECMOD.extract(decay);
+  }
+
+  /// Sets the fixed off time of the current chopper (TOFF), in increments of
+  /// 500 ns: the off time is (@p toff + 1) * 500 ns.
+  void setOffTime(uint8_t toff)
+  {
+    setField(HPSDRegs::TOFF, toff);
+  }
+
+  /// Returns the cached fixed off time (TOFF).
+  uint8_t getOffTime() const
+  {
+    return getField(HPSDRegs::TOFF);
+  }
+
+  /// Selects whether the internal indexer is bypassed (PWMMODE = 1), in which
+  /// case the H-bridges are controlled directly by the xINx pins.
+  void setIndexerBypass(bool bypass)
+  {
+    setField(HPSDRegs::PWMMODE, bypass);
+  }
+
+  /// Returns the cached indexer bypass setting (PWMMODE).
+  bool getIndexerBypass() const
+  {
+    return getField(HPSDRegs::PWMMODE);
+  }
+
+  /// Sets the current trip blanking time (TBLANK), in increments of 20 ns:
+  /// the blanking time is (@p tblank + 1) * 20 ns, with a minimum of 1 us.
+  void setBlankTime(uint8_t tblank)
+  {
+    setField(HPSDRegs::TBLANK, tblank);
+  }
+
+  /// Returns the cached current trip blanking time (TBLANK).
+  uint8_t getBlankTime() const
+  {
+    return getField(HPSDRegs::TBLANK);
+  }
+
+  /// Enables or disables adaptive blanking time (ABT).
+  void setAdaptiveBlanking(bool enable)
+  {
+    setField(HPSDRegs::ABT, enable);
+  }
+
+  /// Returns the cached adaptive blanking setting (ABT).
+  bool getAdaptiveBlanking() const
+  {
+    return getField(HPSDRegs::ABT);
+  }
+
+  /// Sets the mixed decay transition time (TDECAY), in increments of 500 ns.
+  void setDecayTime(uint8_t tdecay)
+  {
+    setField(HPSDRegs::TDECAY, tdecay);
+  }
+
+  /// Returns the cached mixed decay transition time (TDECAY).
+  uint8_t getDecayTime() const
+  {
+    return getField(HPSDRegs::TDECAY);
+  }
+
+  /// Sets the dead time between switching one MOSFET of a half bridge off and
+  /// the other on (DTIME).
+  void setDeadTime(HPSDDeadTime time)
+  {
+    setField(HPSDRegs::DTIME, (uint8_t)time);
+  }
+
+  /// Returns the cached dead time (DTIME).
+  HPSDDeadTime getDeadTime() const
+  {
+    return (HPSDDeadTime)getField(HPSDRegs::DTIME);
+  }
+
+  /// Sets the back-EMF sample threshold time (SMPLTH).
+  void setBemfSampleTime(HPSDBemfSampleTime time)
+  {
+    setField(HPSDRegs::SMPLTH, (uint8_t)time);
+  }
+
+  /// Returns the cached back-EMF sample threshold time (SMPLTH).
+  HPSDBemfSampleTime getBemfSampleTime() const
+  {
+    return (HPSDBemfSampleTime)getField(HPSDRegs::SMPLTH);
+  }
+
+  /// Returns the cached stall detection step count (SDCNT).
+  HPSDStallCount getStallCount() const
+  {
+    return (HPSDStallCount)getField(HPSDRegs::SDCNT);
+  }
+
+  /// Returns the cached back-EMF divider (VDIV).
+  HPSDBemfDivider getBemfDivider() const
+  {
+    return (HPSDBemfDivider)getField(HPSDRegs::VDIV);
+  }
+
+  /// Sets the overcurrent protection threshold (OCPTH) and deglitch time
+  /// (OCPDEG).
+  void setOcp(HPSDOcpThreshold threshold, HPSDOcpDeglitch deglitch)
+  {
+    modifyReg(HPSDRegAddr::DRIVE, HPSDRegs::OCPTH.mask() | HPSDRegs::OCPDEG.mask(),
+      HPSDRegs::OCPTH.encode((uint8_t)threshold) | HPSDRegs::OCPDEG.encode((uint8_t)deglitch));
+    flush();
+  }
+
+  /// Returns the cached overcurrent protection threshold (OCPTH).
+  HPSDOcpThreshold getOcpThreshold() const
+  {
+    return (HPSDOcpThreshold)getField(HPSDRegs::OCPTH);
+  }
+
+  /// Returns the cached overcurrent deglitch time (OCPDEG).
+  HPSDOcpDeglitch getOcpDeglitch() const
+  {
+    return (HPSDOcpDeglitch)getField(HPSDRegs::OCPDEG);
+  }
+
+  /// Sets the gate drive times of the high-side (TDRIVEP) and low-side
+  /// (TDRIVEN) MOSFETs.
+  void setGateDriveTime(HPSDGateDriveTime highSide, HPSDGateDriveTime lowSide)
+  {
+    modifyReg(HPSDRegAddr::DRIVE, HPSDRegs::TDRIVEP.mask() | HPSDRegs::TDRIVEN.mask(),
+      HPSDRegs::TDRIVEP.encode((uint8_t)highSide) | HPSDRegs::TDRIVEN.encode((uint8_t)lowSide));
+    flush();
+  }
+
+  /// Returns the cached high-side gate drive time (TDRIVEP).
+  HPSDGateDriveTime getHighSideDriveTime() const
+  {
+    return (HPSDGateDriveTime)getField(HPSDRegs::TDRIVEP);
+  }
+
+  /// Returns the cached low-side gate drive time (TDRIVEN).
+  HPSDGateDriveTime getLowSideDriveTime() const
+  {
+    return (HPSDGateDriveTime)getField(HPSDRegs::TDRIVEN);
+  }
+
+  /// Sets the gate drive currents: the high-side source current (IDRIVEP) and
+  /// the low-side sink current (IDRIVEN).
+  void setGateDriveCurrent(HPSDSourceCurrent highSide, HPSDSinkCurrent lowSide)
+  {
+    modifyReg(HPSDRegAddr::DRIVE, HPSDRegs::IDRIVEP.mask() | HPSDRegs::IDRIVEN.mask(),
+      HPSDRegs::IDRIVEP.encode((uint8_t)highSide) | HPSDRegs::IDRIVEN.encode((uint8_t)lowSide));
+    flush();
+  }
+
+  /// Returns the cached high-side gate drive source current (IDRIVEP).
+  HPSDSourceCurrent getSourceCurrent() const
+  {
+    return (HPSDSourceCurrent)getField(HPSDRegs::IDRIVEP);
+  }
+
+  /// Returns the cached low-side gate drive sink current (IDRIVEN).
+  HPSDSinkCurrent getSinkCurrent() const
+  {
+    return (HPSDSinkCurrent)getField(HPSDRegs::IDRIVEN);
+  }
+
+  /// Sets any field of the settings registers, using one of the descriptors
+  /// in HPSDRegs.  The cached copy is updated and the register is written if
+  /// it changed (or marked dirty inside beginUpdate()).
+  ///
+  /// Example usage:
+  /// ~~~{.cpp}
+  /// sd.setField(HPSDRegs::TOFF, 0x20);
+  /// ~~~
+  void setField(HPSDField field, uint16_t value)
+  {
+    if (field.address == HPSDRegAddr::STATUS) { return; }
+    modifyField(field, value);
+    flush();
+  }
+
+  /// Returns the cached value of any field of the settings registers.
+  ///
+  /// This does not perform any SPI communication with the driver.
+  uint16_t getField(HPSDField field) const
+  {
+    return field.extract(getConfig().word(field.address));
   }
 
   /// Reads the status of the driver (STATUS register).
@@ -487,50 +1744,314 @@ public:
     driver.writeReg(HPSDRegAddr::STATUS, ~0b00111111);
   }
 
+  /// Watches the driver's FAULTn pin with an interrupt, so that faults can be
+  /// noticed without polling readStatus().
+  ///
+  /// When FAULTn goes low, the interrupt records the event and calls the
+  /// function set with setPinEventCallback(), if any; it does not use SPI.
+  /// Call serviceStatus() from your main loop to read the STATUS register
+  /// once per event.
+  ///
+  /// @return false if the pin does not support interrupts.
+  bool attachFaultPin(uint8_t pin)
+  {
+    faultPin = pin;
+    pinMode(pin, INPUT_PULLUP);
+    return attachInterrupt(pin, &HighPowerStepperDriver::onFaultPin, this, FALLING);
+  }
+
+  /// Watches the driver's STALLn pin with an interrupt.  This works like
+  /// attachFaultPin().
+  ///
+  /// STALLn only indicates a stall while the EXSTALL bit in the CTRL register
+  /// is 0 (the default).
+  bool attachStallPin(uint8_t pin)
+  {
+    stallPin = pin;
+    pinMode(pin, INPUT_PULLUP);
+    return attachInterrupt(pin, &HighPowerStepperDriver::onStallPin, this, FALLING);
+  }
+
+  /// Stops watching the pins attached with attachFaultPin() and
+  /// attachStallPin().
+  void detachStatusPins()
+  {
+    if (faultPin != NoPin) { detachInterrupt(faultPin); faultPin = NoPin; }
+    if (stallPin != NoPin) { detachInterrupt(stallPin); stallPin = NoPin; }
+  }
+
+  /// Sets a function to call from the pin interrupt when FAULTn or STALLn goes
+  /// low, or null for none.
+  ///
+  /// The function runs in interrupt context, so it must not use SPI, but it can
+  /// stop a HPSDStepEngine right away, for example.
+  void setPinEventCallback(HPSDPinEventCallback callback, void * context = nullptr)
+  {
+    ATOMIC_BLOCK()
+    {
+      pinEventCallback = callback;
+      pinEventContext = context;
+    }
+  }
+
+  /// Returns the #HPSDPinEvent bits that have been recorded since the last
+  /// call to serviceStatus().
+  uint8_t getPinEvents() const
+  {
+    return pinEvents;
+  }
+
+  /// Returns the total number of pin events since the pins were attached.
+  uint32_t getPinEventCount() const
+  {
+    return pinEventCount;
+  }
+
+  /// Returns true if the FAULTn pin is attached and currently low.
+  bool isFaultPinLow() const
+  {
+    return faultPin != NoPin && pinReadFast(faultPin) == LOW;
+  }
+
+  /// Returns true if the STALLn pin is attached and currently low.
+  bool isStallPinLow() const
+  {
+    return stallPin != NoPin && pinReadFast(stallPin) == LOW;
+  }
+
+  /// Handles pin events recorded by the interrupt.  If there are any, this
+  /// reads the STATUS register once and stores it for getLatchedStatus().
+  ///
+  /// Call this regularly from your main loop (not from an interrupt).  It does
+  /// no SPI transactions when nothing has happened.
+  ///
+  /// @return true if there were new pin events.
+  bool serviceStatus()
+  {
+    uint8_t events;
+    ATOMIC_BLOCK()
+    {
+      events = pinEvents;
+      pinEvents = 0;
+    }
+    if (events == 0) { return false; }
+
+    latchedStatus = readStatus();
+    return true;
+  }
+
+  /// Returns the STATUS register value read by the last serviceStatus() call
+  /// that found a pin event.  The bits are the same as for readStatus().
+  uint8_t getLatchedStatus() const
+  {
+    return latchedStatus;
+  }
+
 protected:
 
   uint16_t ctrl, torque, off, blank, decay, stall, drive;
 
+  static const uint8_t NoPin = HPSD_NO_PIN;
+
+  void onFaultPin()
+  {
+    recordPinEvent(HPSDPinEvent::Fault);
+  }
+
+  void onStallPin()
+  {
+    recordPinEvent(HPSDPinEvent::Stall);
+  }
+
+  void recordPinEvent(HPSDPinEvent event)
+  {
+    pinEvents |= 1 << (uint8_t)event;
+    pinEventCount++;
+    HPSDPinEventCallback callback = pinEventCallback;
+    if (callback != nullptr) { callback(pinEventContext, event); }
+  }
+
+  uint8_t stepPin = NoPin;
+  uint8_t dirPin = NoPin;
+  uint8_t faultPin = NoPin;
+  uint8_t stallPin = NoPin;
+  volatile uint8_t pinEvents = 0;
+  volatile uint32_t pinEventCount = 0;
+  uint8_t latchedStatus = 0;
+  HPSDPinEventCallback volatile pinEventCallback = nullptr;
+  void * volatile pinEventContext = nullptr;
+
+  /// Mask for getDirtyRegisters() and writeRegisters() covering all seven
+  /// settings registers.
+  static const uint8_t AllRegisters = 0b01111111;
+
+  /// One bit per register whose cached value has not been written yet.
+  uint8_t dirty = 0;
+
+  /// Nesting depth of beginUpdate() calls.
+  uint8_t updateDepth = 0;
+
+  /// The step of the verifyNext() pass to do next: 0 for STATUS, or the
+  /// register address plus 1.
+  uint8_t verifySlot = 0;
+
+  /// One bit per register that did not match during the current verifyNext()
+  /// pass.
+  uint8_t verifyMismatches = 0;
+
+  /// Reads a settings register from the device and returns true if it is
+  /// equal to the cached copy.
+  bool registerMatches(HPSDRegAddr address)
+  {
+    uint16_t expected = cachedReg(address);
+
+    // Bit 10 in TORQUE is write-only and will always read as 0.
+    if (address == HPSDRegAddr::TORQUE) { expected &= ~(1 << 10); }
+
+    return driver.readReg(address) == expected;
+  }
+
+  /// Copies the register values from @p config into the cached settings and
+  /// marks every register dirty.
+  void loadConfig(const HPSDConfig & config)
+  {
+    ATOMIC_BLOCK()
+    {
+      ctrl   = config.ctrl;
+      torque = config.torque;
+      off    = config.off;
+      blank  = config.blank;
+      decay  = config.decay;
+      stall  = config.stall;
+      drive  = config.drive;
+      dirty  = AllRegisters;
+    }
+  }
+
+  /// Returns a reference to the cached copy of the specified settings
+  /// register.  STATUS is not cached; callers must not pass it.
+  uint16_t & cachedReg(HPSDRegAddr address)
+  {
+    switch (address)
+    {
+    case HPSDRegAddr::TORQUE: return torque;
+    case HPSDRegAddr::OFF:    return off;
+    case HPSDRegAddr::BLANK:  return blank;
+    case HPSDRegAddr::DECAY:  return decay;
+    case HPSDRegAddr::STALL:  return stall;
+    case HPSDRegAddr::DRIVE:  return drive;
+    default:                  return ctrl;
+    }
+  }
+
+  /// Replaces the bits selected by @p mask in a cached register with those
+  /// of @p bits, and marks the register dirty if its value changed.
+  ///
+  /// The read-modify-write is done with interrupts disabled, so it cannot be
+  /// torn by another thread changing other bits of the same register.
+  void modifyReg(HPSDRegAddr address, uint16_t mask, uint16_t bits)
+  {
+    uint16_t & reg = cachedReg(address);
+    ATOMIC_BLOCK()
+    {
+      uint16_t value = (reg & ~mask) | (bits & mask);
+      if (value != reg)
+      {
+        reg = value;
+        dirty |= 1 << (uint8_t)address;
+      }
+    }
+  }
+
+  /// Sets one field of a cached register.  See modifyReg().
+  void modifyField(HPSDField field, uint16_t value)
+  {
+    modifyReg(field.address, field.mask(), field.encode(value));
+  }
+
+  /// Writes the dirty registers to the device unless a beginUpdate() is in
+  /// progress.  Setters call this after updating the cache.
+  void flush()
+  {
+    if (updateDepth == 0 && dirty != 0)
+    {
+      writeRegisters(dirty);
+    }
+  }
+
+  /// Writes the cached values of the registers selected by @p mask (one bit
+  /// per register address) in one SPI transaction and marks them clean.
+  ///
+  /// The values are copied while holding the bus lock, so if two threads write
+  /// the same register, the one holding the lock last sends the latest value.
+  void writeRegisters(uint8_t mask)
+  {
+    // CTRL is written last because it contains the ENBL bit, and we want to try
+    // to have all the other settings correct first.  (For example, TORQUE
+    // defaults to 0xFF (the maximum value), so it would be better to set a more
+    // appropriate value if necessary before enabling the motor.)
+    HPSDRegWrite writes[7];
+    uint8_t count = 0;
+    driver.lock();
+    ATOMIC_BLOCK()
+    {
+      if (mask & (1 << (uint8_t)HPSDRegAddr::TORQUE)) { writes[count++] = { HPSDRegAddr::TORQUE, torque }; }
+      if (mask & (1 << (uint8_t)HPSDRegAddr::OFF))    { writes[count++] = { HPSDRegAddr::OFF,    off    }; }
+      if (mask & (1 << (uint8_t)HPSDRegAddr::BLANK))  { writes[count++] = { HPSDRegAddr::BLANK,  blank  }; }
+      if (mask & (1 << (uint8_t)HPSDRegAddr::DECAY))  { writes[count++] = { HPSDRegAddr::DECAY,  decay  }; }
+      if (mask & (1 << (uint8_t)HPSDRegAddr::DRIVE))  { writes[count++] = { HPSDRegAddr::DRIVE,  drive  }; }
+      if (mask & (1 << (uint8_t)HPSDRegAddr::STALL))  { writes[count++] = { HPSDRegAddr::STALL,  stall  }; }
+      if (mask & (1 << (uint8_t)HPSDRegAddr::CTRL))   { writes[count++] = { HPSDRegAddr::CTRL,   ctrl   }; }
+      dirty &= ~mask;
+    }
+
+    if (count)
+    {
+      driver.writeRegs(writes, count);
+    }
+    driver.unlock();
+  }
+
   /// Writes the cached value of the CTRL register to the device.
   void writeCTRL()
   {
-    driver.writeReg(HPSDRegAddr::CTRL, ctrl);
+    writeRegisters(1 << (uint8_t)HPSDRegAddr::CTRL);
   }
 
   /// Writes the cached value of the TORQUE register to the device.
   void writeTORQUE()
   {
-    driver.writeReg(HPSDRegAddr::TORQUE, torque);
+    writeRegisters(1 << (uint8_t)HPSDRegAddr::TORQUE);
   }
 
   /// Writes the cached value of the OFF register to the device.
   void writeOFF()
   {
-    driver.writeReg(HPSDRegAddr::OFF, off);
+    writeRegisters(1 << (uint8_t)HPSDRegAddr::OFF);
   }
 
   /// Writes the cached value of the BLANK register to the device.
   void writeBLANK()
   {
-    driver.writeReg(HPSDRegAddr::BLANK, blank);
+    writeRegisters(1 << (uint8_t)HPSDRegAddr::BLANK);
   }
 
   /// Writes the cached value of the DECAY register to the device.
   void writeDECAY()
   {
-    driver.writeReg(HPSDRegAddr::DECAY, decay);
+    writeRegisters(1 << (uint8_t)HPSDRegAddr::DECAY);
   }
 
   /// Writes the cached value of the STALL register to the device.
   void writeSTALL()
   {
-    driver.writeReg(HPSDRegAddr::STALL, stall);
+    writeRegisters(1 << (uint8_t)HPSDRegAddr::STALL);
   }
 
   /// Writes the cached value of the DRIVE register to the device.
   void writeDRIVE()
   {
-    driver.writeReg(HPSDRegAddr::DRIVE, drive);
+    writeRegisters(1 << (uint8_t)HPSDRegAddr::DRIVE);
   }
 
 public:
@@ -0,0 +1,100 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file HostTest.h
+///
+/// This file defines the small test framework used by the host tests.
+///
+/// Define a test with TEST(name) { ... } in any test_*.cpp file, and check
+/// conditions inside it with CHECK() and CHECK_EQUAL().  A failed check
+/// prints its file, line, and values, and the test carries on, so one run
+/// shows every failure.  main.cpp runs every test and returns nonzero if any
+/// check failed.
+
+#pragma once
+
+#include <stdio.h>
+
+class HostTest
+{
+public:
+  typedef void (*Function)();
+
+  HostTest(const char * name, Function function)
+    : name(name), function(function), next(first())
+  {
+    first() = this;
+  }
+
+  /// Runs every test, prints a summary, and returns the number of failed
+  /// checks.
+  static unsigned runAll()
+  {
+    unsigned tests = 0, failedTests = 0;
+    unsigned totalFailures = 0;
+    for (HostTest * test = first(); test != nullptr; test = test->next)
+    {
+      unsigned before = failures();
+      test->function();
+      tests++;
+      if (failures() != before)
+      {
+        failedTests++;
+        printf("FAIL %s\n", test->name);
+      }
+    }
+    totalFailures = failures();
+    printf("%u tests, %u failed, %u failed checks\n", tests, failedTests, totalFailures);
+    return totalFailures;
+  }
+
+  static bool check(bool ok, const char * expression, const char * file, int line)
+  {
+    if (!ok)
+    {
+      printf("%s:%d: check failed: %s\n", file, line, expression);
+      failures()++;
+    }
+    return ok;
+  }
+
+  static bool checkEqual(long long actual, long long expected, const char * actualText,
+    const char * expectedText, const char * file, int line)
+  {
+    if (actual != expected)
+    {
+      printf("%s:%d: check failed: %s == %s (%lld != %lld)\n", file, line,
+        actualText, expectedText, actual, expected);
+      failures()++;
+    }
+    return actual == expected;
+  }
+
+private:
+  static HostTest *& first()
+  {
+    static HostTest * test = nullptr;
+    return test;
+  }
+
+  static unsigned & failures()
+  {
+    static unsigned count = 0;
+    return count;
+  }
+
+  const char * name;
+  Function function;
+  HostTest * next;
+};
+
+#define TEST(name) \
+  static void name(); \
+  static HostTest name##Test(#name, name); \
+  static void name()
+
+#define CHECK(condition) \
+  HostTest::check((condition), #condition, __FILE__, __LINE__)
+
+#define CHECK_EQUAL(actual, expected) \
+  HostTest::checkEqual((long long)(actual), (long long)(expected), #actual, #expected, \
+    __FILE__, __LINE__)
@@ -0,0 +1,8 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+#include "HostTest.h"
+
+int main()
+{
+  return HostTest::runAll() == 0 ? 0 : 1;
+}
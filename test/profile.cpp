@@ -0,0 +1,129 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+// Measures how fast the planner and the mock-backed driver run on this PC.
+//
+// Each line shows how many operations per second the host managed, measured
+// in real time.  The planner lines also show the planned move time next to
+// the time an ideal trapezoid would take, so a planner that falls short of
+// its maximum speed shows up as a ratio above 1.
+
+#include <math.h>
+#include <chrono>
+#include "HighPowerStepperDriver.h"
+#include "HPSDMockDRV8711.h"
+#include "HPSDMotionPlanner.h"
+#include "HPSDStepEngine.h"
+
+static double now()
+{
+  using namespace std::chrono;
+  return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void report(const char * name, double count, double seconds, const char * unit)
+{
+  printf("%-36s %12.2f M%s/s\n", name, count / seconds / 1e6, unit);
+}
+
+/// Runs a whole move through the planner and returns the planned time.
+static double runPlanner(uint32_t steps, uint32_t speed, uint32_t accel, uint32_t jerk,
+  double & seconds)
+{
+  HPSDMotionPlanner planner;
+  double start = now();
+  planner.plan(steps, speed, accel, jerk);
+  uint64_t totalUs = planner.getIntervalUs();
+  uint32_t interval;
+  while ((interval = planner.nextInterval()) != 0) { totalUs += interval; }
+  seconds = now() - start;
+  return totalUs / 1e6;
+}
+
+static void profilePlanner(uint32_t steps, uint32_t speed, uint32_t accel, uint32_t jerk)
+{
+  double seconds;
+  double planned = runPlanner(steps, speed, accel, jerk, seconds);
+
+  // Accelerate for v / a, cruise, and decelerate for v / a.
+  double v = speed, a = accel;
+  double ideal = steps >= v * v / a ? steps / v + v / a : 2 * sqrt(steps / a);
+
+  char name[64];
+  snprintf(name, sizeof(name), "planner %s v=%lu a=%lu", jerk ? "S-curve" : "trapezoid",
+    (unsigned long)speed, (unsigned long)accel);
+  printf("%-36s %12.2f Msteps/s  move %.3f s, ideal %.3f s (%.3fx)\n", name,
+    steps / seconds / 1e6, planned, ideal, planned / ideal);
+}
+
+int main()
+{
+  const uint32_t Steps = 10000000;
+
+  profilePlanner(Steps, 20000, 8000, 0);
+  profilePlanner(Steps, 200000, 1000000, 0);
+  profilePlanner(Steps, 200000, 1000000, 1000000000);
+
+  HPSDMockDRV8711 mock;
+  HighPowerStepperDriver sd;
+  sd.driver.setTransport(&mock);
+  sd.resetSettings();
+  sd.setCurrentMilliamps36v4(1500);
+
+  {
+    const uint32_t Count = 2000000;
+    double start = now();
+    for (uint32_t i = 0; i < Count; i++) { sd.step(); }
+    report("SPI steps (sd.step())", Count, now() - start, "steps");
+  }
+
+  {
+    const uint32_t Count = 200000;
+    double start = now();
+    for (uint32_t i = 0; i < Count; i++)
+    {
+      sd.beginUpdate();
+      sd.setCurrentMilliamps36v4(1000 + (i & 1023));
+      sd.setDecayMode(i & 1 ? HPSDDecayMode::AutoMixed : HPSDDecayMode::Mixed);
+      sd.setOffTime(i);
+      sd.commit();
+    }
+    report("batched updates (beginUpdate())", Count, now() - start, "commits");
+  }
+
+  {
+    const uint32_t Count = 200000;
+    double start = now();
+    for (uint32_t i = 0; i < Count; i++) { sd.applySettings(); }
+    report("applySettings() (7 registers)", Count, now() - start, "calls");
+  }
+
+  {
+    const uint32_t Count = 2000000;
+    double start = now();
+    for (uint32_t i = 0; i < Count; i++) { sd.verifyNext(); }
+    report("verifyNext()", Count, now() - start, "calls");
+  }
+
+  {
+    // STEP pulses from the engine's timer interrupt, with the simulated
+    // time running as fast as the host can go.
+    const uint8_t StepPin = 10;
+    hostReset();
+    sd.setStepDirPins(StepPin);
+    hostPins[StepPin].onWrite = [&mock](bool high) { if (high) { mock.pulseStep(); } };
+
+    HPSDStepEngine engine;
+    engine.begin(sd);
+    double start = now();
+    engine.moveBy(Steps, 100000, 1000000);
+    while (engine.isRunning()) { hostAdvance(100000); }
+    double seconds = now() - start;
+    report("engine STEP pulses (simulated timer)", Steps, seconds, "steps");
+    printf("%-36s %12.3f s simulated, position %ld\n", "", hostMicros / 1e6,
+      (long)engine.getPosition());
+  }
+
+  printf("%lu frames written, %lu read\n", (unsigned long)mock.getWriteCount(),
+    (unsigned long)mock.getReadCount());
+  return 0;
+}
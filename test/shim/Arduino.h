@@ -0,0 +1,304 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file Arduino.h
+///
+/// This file stands in for the parts of Particle Device OS that the library
+/// uses, so that the library can be built and run on a PC (see
+/// test/Makefile).
+///
+/// Time is simulated: micros() and millis() only move when hostAdvance() (or
+/// delay()) is called, and hostAdvance() runs the interrupts of the simulated
+/// step timers as their deadlines pass.  Pins only keep their levels, and
+/// the SPI peripheral shifts in zeros, so a driver should be given an
+/// HPSDMockDRV8711 with DRV8711SPI::setTransport().  Interrupts run in the
+/// thread that causes them, so ATOMIC_BLOCK() does nothing.
+
+#pragma once
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+
+/// Defined for host builds, which HPSDStepTimer.cpp checks for.
+#define HPSD_HOST 1
+
+typedef uint16_t pin_t;
+
+enum PinState { LOW = 0, HIGH = 1 };
+enum PinMode { INPUT, OUTPUT, INPUT_PULLUP, INPUT_PULLDOWN };
+enum InterruptMode { CHANGE, RISING, FALLING };
+enum BitOrder { LSBFIRST, MSBFIRST };
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x01
+#define SPI_MODE2 0x02
+#define SPI_MODE3 0x03
+
+/// The number of pins that the shim simulates.
+const pin_t HostPinCount = 256;
+
+/// The simulated state of one pin.
+struct HostPin
+{
+  uint8_t level;
+  uint8_t mode;
+
+  /// The number of low-to-high changes written by the library.
+  uint32_t rises;
+
+  /// Called after the library changes the level of the pin, for example to
+  /// pass STEP and DIR edges on to an HPSDMockDRV8711.
+  std::function<void(bool)> onWrite;
+
+  /// The handler set with attachInterrupt(), and when to call it.
+  std::function<void()> interrupt;
+  InterruptMode interruptMode;
+};
+
+extern HostPin hostPins[HostPinCount];
+
+/// Puts every pin back to an unconnected low input and the simulated time
+/// back to 0.  Call this at the start of a test that uses pins or time.
+void hostReset();
+
+/// Changes the level of a pin as the library would, counting rising edges
+/// and calling the pin's onWrite function.
+void hostWritePin(pin_t pin, uint8_t level);
+
+/// Changes the level of an input pin from outside, as a device connected to
+/// it would, and runs its interrupt handler if the change matches.
+void hostDrivePin(pin_t pin, uint8_t level);
+
+inline void pinMode(pin_t pin, PinMode mode)
+{
+  if (pin >= HostPinCount) { return; }
+  hostPins[pin].mode = mode;
+  if (mode == INPUT_PULLUP) { hostPins[pin].level = HIGH; }
+}
+
+inline void digitalWrite(pin_t pin, uint8_t value)
+{
+  hostWritePin(pin, value ? HIGH : LOW);
+}
+
+inline int32_t digitalRead(pin_t pin)
+{
+  return pin < HostPinCount ? hostPins[pin].level : (uint8_t)LOW;
+}
+
+inline void pinSetFast(pin_t pin)
+{
+  hostWritePin(pin, HIGH);
+}
+
+inline void pinResetFast(pin_t pin)
+{
+  hostWritePin(pin, LOW);
+}
+
+inline int32_t pinReadFast(pin_t pin)
+{
+  return digitalRead(pin);
+}
+
+template <typename T> bool attachInterrupt(pin_t pin, void (T::*handler)(), T * instance,
+  InterruptMode mode, int8_t priority = -1, uint8_t subpriority = 0)
+{
+  (void)priority;
+  (void)subpriority;
+  if (pin >= HostPinCount) { return false; }
+  hostPins[pin].interrupt = [handler, instance]() { (instance->*handler)(); };
+  hostPins[pin].interruptMode = mode;
+  return true;
+}
+
+inline bool detachInterrupt(pin_t pin)
+{
+  if (pin >= HostPinCount) { return false; }
+  hostPins[pin].interrupt = nullptr;
+  return true;
+}
+
+/// The simulated time in microseconds.
+extern uint64_t hostMicros;
+
+/// Moves the simulated time forward, running the interrupt of each
+/// simulated step timer whose deadline passes, in order.
+void hostAdvance(uint32_t us);
+
+inline uint32_t micros()
+{
+  return (uint32_t)hostMicros;
+}
+
+inline uint32_t millis()
+{
+  return (uint32_t)(hostMicros / 1000);
+}
+
+inline void delayMicroseconds(uint32_t us)
+{
+  hostAdvance(us);
+}
+
+inline void delay(uint32_t ms)
+{
+  hostAdvance(ms * 1000);
+}
+
+#define ATOMIC_BLOCK() for (bool hostAtomicOnce = true; hostAtomicOnce; hostAtomicOnce = false)
+
+typedef void (*HAL_Direct_Interrupt_Handler)(void);
+
+/// The interrupts of the simulated step timers.
+enum IRQn_Type { HostTimer0_IRQn, HostTimer1_IRQn };
+
+/// The number of simulated step timers.
+const uint8_t HostTimerCount = 2;
+
+/// A simulated hardware timer with a 1 MHz counter.  When the counter reaches
+/// the reload value, it restarts from 0, the event flag is set, and the
+/// attached interrupt runs.
+struct HostTimer
+{
+  bool enabled;
+  bool event;
+  uint32_t count;
+  uint32_t reload;
+  HAL_Direct_Interrupt_Handler handler;
+};
+
+extern HostTimer hostTimers[HostTimerCount];
+
+bool attachInterruptDirect(IRQn_Type irq, HAL_Direct_Interrupt_Handler handler, bool enable = true);
+bool detachInterruptDirect(IRQn_Type irq, bool disable = true);
+
+/// System.ticks() counts real time, not simulated time, at 120 ticks per
+/// microsecond like a Photon's cycle counter, so the HPSD_SPI_STATS timings
+/// measure the host.
+class SystemClass
+{
+public:
+  uint32_t ticks();
+
+  static uint32_t ticksPerMicrosecond()
+  {
+    return 120;
+  }
+};
+
+extern SystemClass System;
+
+class SPISettings
+{
+public:
+  SPISettings() {}
+  SPISettings(uint32_t clock, BitOrder bitOrder, uint8_t dataMode)
+    : clock(clock), bitOrder(bitOrder), dataMode(dataMode) {}
+
+  uint32_t clock = 0;
+  BitOrder bitOrder = MSBFIRST;
+  uint8_t dataMode = SPI_MODE0;
+};
+
+typedef void (*wiring_spi_dma_transfercomplete_callback_t)(void);
+
+/// A simulated SPI peripheral with nothing connected: it counts bytes and
+/// transactions, and reads zeros.  A DMA transfer completes, and calls its
+/// callback, before it returns.
+class SPIClass
+{
+public:
+  void beginTransaction(const SPISettings & settings)
+  {
+    this->settings = settings;
+    transactions++;
+  }
+
+  void endTransaction() {}
+
+  uint8_t transfer(uint8_t value)
+  {
+    (void)value;
+    bytes++;
+    return 0;
+  }
+
+  void transfer(const void * tx, void * rx, size_t length,
+    wiring_spi_dma_transfercomplete_callback_t callback)
+  {
+    (void)tx;
+    if (rx != nullptr) { memset(rx, 0, length); }
+    bytes += length;
+    if (callback != nullptr) { callback(); }
+  }
+
+  SPISettings settings;
+  uint32_t transactions = 0;
+  uint32_t bytes = 0;
+};
+
+extern SPIClass SPI;
+
+class Print
+{
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t c) = 0;
+
+  virtual size_t write(const uint8_t * buffer, size_t size)
+  {
+    size_t n = 0;
+    while (size--) { n += write(*buffer++); }
+    return n;
+  }
+
+  size_t print(const char * s)
+  {
+    return write((const uint8_t *)s, strlen(s));
+  }
+
+  size_t println(const char * s = "")
+  {
+    return print(s) + print("\r\n");
+  }
+
+  size_t printf(const char * format, ...) __attribute__((format(printf, 2, 3)))
+  {
+    va_list args;
+    va_start(args, format);
+    size_t n = vprint(false, format, args);
+    va_end(args);
+    return n;
+  }
+
+  size_t printlnf(const char * format, ...) __attribute__((format(printf, 2, 3)))
+  {
+    va_list args;
+    va_start(args, format);
+    size_t n = vprint(true, format, args);
+    va_end(args);
+    return n;
+  }
+
+private:
+  size_t vprint(bool newline, const char * format, va_list args)
+  {
+    char buffer[256];
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    return newline ? println(buffer) : print(buffer);
+  }
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() {}
+};
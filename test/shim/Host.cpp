@@ -0,0 +1,97 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+#include <Arduino.h>
+#include <chrono>
+
+HostPin hostPins[HostPinCount];
+HostTimer hostTimers[HostTimerCount];
+uint64_t hostMicros = 0;
+SystemClass System;
+SPIClass SPI;
+
+void hostReset()
+{
+  for (pin_t i = 0; i < HostPinCount; i++) { hostPins[i] = HostPin(); }
+  hostMicros = 0;
+}
+
+void hostWritePin(pin_t pin, uint8_t level)
+{
+  if (pin >= HostPinCount) { return; }
+  HostPin & p = hostPins[pin];
+  if (p.level == level) { return; }
+  p.level = level;
+  if (level == HIGH) { p.rises++; }
+  if (p.onWrite) { p.onWrite(level == HIGH); }
+}
+
+void hostDrivePin(pin_t pin, uint8_t level)
+{
+  if (pin >= HostPinCount) { return; }
+  HostPin & p = hostPins[pin];
+  if (p.level == level) { return; }
+  p.level = level;
+  if (!p.interrupt) { return; }
+  if (p.interruptMode == CHANGE || (p.interruptMode == RISING) == (level == HIGH))
+  {
+    p.interrupt();
+  }
+}
+
+void hostAdvance(uint32_t us)
+{
+  uint64_t end = hostMicros + us;
+  while (true)
+  {
+    // Jump to the next timer deadline, or to the end.
+    uint64_t step = end - hostMicros;
+    for (uint8_t i = 0; i < HostTimerCount; i++)
+    {
+      const HostTimer & t = hostTimers[i];
+      if (!t.enabled) { continue; }
+      uint32_t left = t.reload > t.count ? t.reload - t.count : 0;
+      if (left < step) { step = left; }
+    }
+
+    hostMicros += step;
+    bool expired = false;
+    for (uint8_t i = 0; i < HostTimerCount; i++)
+    {
+      HostTimer & t = hostTimers[i];
+      if (!t.enabled) { continue; }
+      t.count += step;
+      if (t.count >= t.reload)
+      {
+        t.count = 0;
+        t.event = true;
+        expired = true;
+        if (t.handler != nullptr) { t.handler(); }
+      }
+    }
+
+    if (!expired && hostMicros >= end) { return; }
+  }
+}
+
+bool attachInterruptDirect(IRQn_Type irq, HAL_Direct_Interrupt_Handler handler, bool enable)
+{
+  (void)enable;
+  if (irq >= HostTimerCount) { return false; }
+  hostTimers[irq].handler = handler;
+  return true;
+}
+
+bool detachInterruptDirect(IRQn_Type irq, bool disable)
+{
+  (void)disable;
+  if (irq >= HostTimerCount) { return false; }
+  hostTimers[irq].handler = nullptr;
+  return true;
+}
+
+uint32_t SystemClass::ticks()
+{
+  using namespace std::chrono;
+  static const steady_clock::time_point start = steady_clock::now();
+  return (uint32_t)(duration_cast<nanoseconds>(steady_clock::now() - start).count() * 120 / 1000);
+}
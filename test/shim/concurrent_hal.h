@@ -0,0 +1,46 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+/// \file concurrent_hal.h
+///
+/// This file stands in for the recursive mutexes of Particle Device OS in
+/// host builds.  The host tests run in one thread, so a mutex only counts how
+/// deeply it is locked.
+
+#pragma once
+
+struct HostMutex
+{
+  unsigned depth;
+};
+
+typedef HostMutex * os_mutex_recursive_t;
+
+inline int os_mutex_recursive_create(os_mutex_recursive_t * mutex)
+{
+  *mutex = new HostMutex();
+  return 0;
+}
+
+inline int os_mutex_recursive_destroy(os_mutex_recursive_t mutex)
+{
+  delete mutex;
+  return 0;
+}
+
+inline int os_mutex_recursive_lock(os_mutex_recursive_t mutex)
+{
+  mutex->depth++;
+  return 0;
+}
+
+inline int os_mutex_recursive_trylock(os_mutex_recursive_t mutex)
+{
+  mutex->depth++;
+  return 0;
+}
+
+inline int os_mutex_recursive_unlock(os_mutex_recursive_t mutex)
+{
+  mutex->depth--;
+  return 0;
+}
@@ -0,0 +1,196 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+// Checks the SPI traffic of HighPowerStepperDriver against the mock DRV8711:
+// how setters and beginUpdate()/commit() batch their writes, and how
+// verifyNext() finds and repairs registers that do not match.
+
+#include "HostTest.h"
+#include "HighPowerStepperDriver.h"
+#include "HPSDMockDRV8711.h"
+
+namespace
+{
+  typedef HPSDMockDRV8711 Mock;
+
+  // Connects the driver to the mock with default settings and clears every
+  // count.
+  void setUp(HighPowerStepperDriver & sd, Mock & mock)
+  {
+    sd.driver.setTransport(&mock);
+    sd.resetSettings();
+    mock.resetCounts();
+    sd.getSpiStats().reset();
+  }
+
+  // Runs one full pass of verifyNext() and returns the result of each call.
+  void verifyPass(HighPowerStepperDriver & sd, HPSDVerifyResult * results, bool repair = true)
+  {
+    for (uint8_t i = 0; i < 8; i++) { results[i] = sd.verifyNext(repair); }
+  }
+}
+
+TEST(setterWritesImmediately)
+{
+  HighPowerStepperDriver sd;
+  Mock mock;
+  setUp(sd, mock);
+
+  sd.setOffTime(0x50);
+  CHECK_EQUAL(mock.getWriteCount(), 1);
+  CHECK_EQUAL(mock.getWriteCount(Mock::OFF), 1);
+  CHECK_EQUAL(mock.getRegister(Mock::OFF) & 0xFF, 0x50);
+  CHECK_EQUAL(sd.getDirtyRegisters(), 0);
+
+  // Setting the same value again costs nothing.
+  sd.setOffTime(0x50);
+  CHECK_EQUAL(mock.getWriteCount(), 1);
+}
+
+TEST(commitWritesChangedRegistersOnce)
+{
+  HighPowerStepperDriver sd;
+  Mock mock;
+  setUp(sd, mock);
+
+  sd.beginUpdate();
+  sd.setCurrentMilliamps36v4(3000);
+  sd.setDecayMode(HPSDDecayMode::AutoMixed);
+  sd.setOffTime(0x50);
+  sd.setStepMode(32);
+  sd.setDirection(1);
+  CHECK_EQUAL(mock.getWriteCount(), 0);
+  CHECK_EQUAL(sd.getDirtyRegisters(),
+    (1 << Mock::CTRL) | (1 << Mock::TORQUE) | (1 << Mock::OFF) | (1 << Mock::DECAY));
+  sd.commit();
+
+  CHECK_EQUAL(mock.getWriteCount(), 4);
+  CHECK_EQUAL(mock.getWriteCount(Mock::CTRL), 1);
+  CHECK_EQUAL(mock.getWriteCount(Mock::TORQUE), 1);
+  CHECK_EQUAL(mock.getWriteCount(Mock::OFF), 1);
+  CHECK_EQUAL(mock.getWriteCount(Mock::DECAY), 1);
+  CHECK_EQUAL(sd.getSpiStats().batches.count, 1);
+  CHECK_EQUAL(sd.getDirtyRegisters(), 0);
+  CHECK(sd.verifySettings());
+}
+
+TEST(nestedCommitWritesAtOutermost)
+{
+  HighPowerStepperDriver sd;
+  Mock mock;
+  setUp(sd, mock);
+
+  sd.beginUpdate();
+  sd.setOffTime(0x50);
+  sd.beginUpdate();
+  sd.setDecayMode(HPSDDecayMode::Fast);
+  sd.commit();
+  CHECK_EQUAL(mock.getWriteCount(), 0);
+  sd.commit();
+  CHECK_EQUAL(mock.getWriteCount(), 2);
+  CHECK_EQUAL(sd.getSpiStats().batches.count, 1);
+
+  // An unmatched commit() does nothing harmful.
+  sd.commit();
+  CHECK_EQUAL(mock.getWriteCount(), 2);
+}
+
+TEST(verifyNextRepairsMismatches)
+{
+  HighPowerStepperDriver sd;
+  Mock mock;
+  setUp(sd, mock);
+  uint16_t off = mock.getRegister(Mock::OFF);
+  uint16_t stall = mock.getRegister(Mock::STALL);
+  mock.setRegister(Mock::OFF, off ^ 0x0FF);
+  mock.setRegister(Mock::STALL, stall ^ 0x300);
+
+  HPSDVerifyResult results[8];
+  verifyPass(sd, results);
+  CHECK(results[0] == HPSDVerifyResult::Match);
+  CHECK(results[1 + Mock::OFF] == HPSDVerifyResult::Mismatch);
+  CHECK(results[1 + Mock::STALL] == HPSDVerifyResult::Mismatch);
+  CHECK(results[1 + Mock::DRIVE] == HPSDVerifyResult::Repaired);
+  CHECK_EQUAL(mock.getReadCount(), 8);
+  CHECK_EQUAL(mock.getWriteCount(), 2);
+  CHECK_EQUAL(mock.getWriteCount(Mock::OFF), 1);
+  CHECK_EQUAL(mock.getWriteCount(Mock::STALL), 1);
+  CHECK_EQUAL(mock.getRegister(Mock::OFF), off);
+  CHECK_EQUAL(mock.getRegister(Mock::STALL), stall);
+
+  // The repaired registers match on the next pass, which writes nothing.
+  mock.resetCounts();
+  verifyPass(sd, results);
+  for (uint8_t i = 0; i < 8; i++) { CHECK(results[i] == HPSDVerifyResult::Match); }
+  CHECK_EQUAL(mock.getReadCount(), 8);
+  CHECK_EQUAL(mock.getWriteCount(), 0);
+}
+
+TEST(verifyNextWithoutRepairWritesNothing)
+{
+  HighPowerStepperDriver sd;
+  Mock mock;
+  setUp(sd, mock);
+  mock.setRegister(Mock::BLANK, mock.getRegister(Mock::BLANK) ^ 1);
+
+  HPSDVerifyResult results[8];
+  verifyPass(sd, results, false);
+  CHECK(results[1 + Mock::BLANK] == HPSDVerifyResult::Mismatch);
+  CHECK(results[1 + Mock::DRIVE] == HPSDVerifyResult::Match);
+  CHECK_EQUAL(mock.getWriteCount(), 0);
+}
+
+TEST(verifyNextSkipsUncommittedRegisters)
+{
+  HighPowerStepperDriver sd;
+  Mock mock;
+  setUp(sd, mock);
+
+  sd.beginUpdate();
+  sd.setOffTime(0x50);
+  HPSDVerifyResult results[8];
+  verifyPass(sd, results);
+  for (uint8_t i = 0; i < 8; i++) { CHECK(results[i] == HPSDVerifyResult::Match); }
+  CHECK_EQUAL(mock.getWriteCount(), 0);
+  sd.commit();
+  CHECK_EQUAL(mock.getWriteCount(Mock::OFF), 1);
+}
+
+TEST(verifyNextRestoresSettingsAfterBrownout)
+{
+  HighPowerStepperDriver sd;
+  Mock mock;
+  setUp(sd, mock);
+  sd.setCurrentMilliamps36v4(3000);
+  sd.setStepMode(16);
+  sd.enableDriver();
+  CHECK(mock.isEnabled());
+
+  mock.brownout();
+  mock.resetCounts();
+  CHECK(!mock.isEnabled());
+  CHECK(sd.verifyNext() == HPSDVerifyResult::Undervoltage);
+  CHECK_EQUAL(mock.getWriteCount(), 8);
+  CHECK_EQUAL(mock.getWriteCount(Mock::STATUS), 1);
+  CHECK(!(mock.getRegister(Mock::STATUS) & (1 << Mock::UVLO)));
+  CHECK(mock.isEnabled());
+  CHECK(sd.verifySettings());
+}
+
+TEST(writeStepModeLeavesCtrlClean)
+{
+  HighPowerStepperDriver sd;
+  Mock mock;
+  setUp(sd, mock);
+
+  sd.beginUpdate();
+  sd.setDirection(1);
+  sd.setOffTime(0x50);
+  sd.writeStepMode(HPSDRegs::modeBits(8));
+  CHECK_EQUAL(mock.getWriteCount(Mock::CTRL), 1);
+  CHECK_EQUAL(mock.getRegister(Mock::CTRL) & ((0xF << 3) | (1 << 1)), (0b0011 << 3) | (1 << 1));
+  CHECK_EQUAL(sd.getDirtyRegisters(), 1 << Mock::OFF);
+
+  sd.commit();
+  CHECK_EQUAL(mock.getWriteCount(Mock::CTRL), 1);
+  CHECK_EQUAL(mock.getWriteCount(Mock::OFF), 1);
+}
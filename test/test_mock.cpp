@@ -0,0 +1,121 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+// Checks that HPSDMockDRV8711 behaves like the registers of a DRV8711, and
+// that an HPSDStepEngine runs against it on the simulated step timer.
+
+#include "HostTest.h"
+#include "HighPowerStepperDriver.h"
+#include "HPSDMockDRV8711.h"
+#include "HPSDStepEngine.h"
+
+TEST(mockTorqueBit10IsWriteOnly)
+{
+  HPSDMockDRV8711 mock;
+  HighPowerStepperDriver sd;
+  sd.driver.setTransport(&mock);
+
+  sd.driver.writeReg(HPSDRegAddr::TORQUE, 0x5FF);
+  CHECK_EQUAL(mock.getRegister(HPSDMockDRV8711::TORQUE), 0x5FF);
+  CHECK_EQUAL(sd.driver.readReg(HPSDRegAddr::TORQUE), 0x1FF);
+}
+
+TEST(mockStepClearsRstep)
+{
+  HPSDMockDRV8711 mock;
+  HighPowerStepperDriver sd;
+  sd.driver.setTransport(&mock);
+  sd.resetSettings();
+
+  sd.step();
+  sd.step();
+  CHECK_EQUAL(mock.getPosition(), 2);
+  CHECK_EQUAL(sd.driver.readReg(HPSDRegAddr::CTRL) & (1 << 2), 0);
+
+  sd.setDirection(1);
+  sd.step();
+  CHECK_EQUAL(mock.getPosition(), 1);
+}
+
+TEST(mockStatusClearsOnWrite)
+{
+  HPSDMockDRV8711 mock;
+  HighPowerStepperDriver sd;
+  sd.driver.setTransport(&mock);
+
+  mock.setFaults((1 << HPSDMockDRV8711::OTS) | (1 << HPSDMockDRV8711::AOCP));
+  CHECK_EQUAL(sd.readStatus(), 0b11);
+
+  // Writing 1 leaves a bit alone; writing 0 clears it.
+  sd.driver.writeReg(HPSDRegAddr::STATUS, ~(1 << HPSDMockDRV8711::OTS) & 0xFFF);
+  CHECK_EQUAL(sd.readStatus(), 0b10);
+  sd.clearStatus();
+  CHECK_EQUAL(sd.readStatus(), 0);
+}
+
+TEST(mockBrownoutRestoresDefaults)
+{
+  HPSDMockDRV8711 mock;
+  HighPowerStepperDriver sd;
+  sd.driver.setTransport(&mock);
+  sd.resetSettings();
+  sd.setCurrentMilliamps36v4(2000);
+  sd.enableDriver();
+  CHECK(sd.verifySettings());
+
+  mock.brownout();
+  CHECK(!mock.isEnabled());
+  CHECK(!sd.verifySettings());
+  CHECK(sd.readStatus() & (1 << HPSDMockDRV8711::UVLO));
+}
+
+TEST(engineStepsMockOnSimulatedTimer)
+{
+  const uint8_t StepPin = 10, DirPin = 11;
+  hostReset();
+
+  HPSDMockDRV8711 mock;
+  HighPowerStepperDriver sd;
+  sd.driver.setTransport(&mock);
+  sd.resetSettings();
+  sd.setStepDirPins(StepPin, DirPin);
+  hostPins[StepPin].onWrite = [&mock](bool high) { if (high) { mock.pulseStep(); } };
+  hostPins[DirPin].onWrite = [&mock](bool high) { mock.setDirPin(high); };
+
+  HPSDStepEngine engine;
+  CHECK(engine.begin(sd));
+
+  engine.moveBy(3000, 8000, 40000);
+  while (engine.isRunning()) { hostAdvance(1000); }
+  CHECK_EQUAL(engine.getPosition(), 3000);
+  CHECK_EQUAL(mock.getPosition(), 3000);
+  CHECK_EQUAL(hostPins[StepPin].rises, 3000);
+
+  engine.moveBy(-5000, 8000, 40000);
+  while (engine.isRunning()) { hostAdvance(1000); }
+  CHECK_EQUAL(engine.getPosition(), -2000);
+  CHECK_EQUAL(mock.getPosition(), -2000);
+}
+
+TEST(engineWrapsPositionAtInt32Limits)
+{
+  const uint8_t StepPin = 10, DirPin = 11;
+  hostReset();
+
+  CHECK_EQUAL(HPSDStepEngine::distance(INT32_MIN), 0x80000000);
+  CHECK_EQUAL(HPSDStepEngine::distance(INT32_MAX), 0x7FFFFFFF);
+  CHECK_EQUAL(HPSDStepEngine::distance(-5), 5);
+
+  HPSDStepEngine engine;
+  CHECK(engine.begin(StepPin, DirPin));
+  engine.setPosition(INT32_MAX - 1);
+
+  engine.moveBy(3, 8000, 40000);
+  while (engine.isRunning()) { hostAdvance(1000); }
+  CHECK_EQUAL(engine.getPosition(), INT32_MIN + 1);
+
+  // The shortest way back is 3 steps in reverse, across the limit again.
+  engine.moveTo(INT32_MAX - 1, 8000, 40000);
+  while (engine.isRunning()) { hostAdvance(1000); }
+  CHECK_EQUAL(engine.getPosition(), INT32_MAX - 1);
+  CHECK_EQUAL(hostPins[StepPin].rises, 6);
+}
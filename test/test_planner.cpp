@@ -0,0 +1,188 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+// Checks the step timing of HPSDMotionPlanner against the ideal profiles.
+
+#include <math.h>
+#include "HostTest.h"
+#include "HPSDMotionPlanner.h"
+
+namespace
+{
+  struct PlannedMove
+  {
+    uint32_t firstUs;
+    uint32_t lastUs;
+    uint32_t minUs;
+    uint32_t intervals;
+    double seconds;
+  };
+
+  // Runs the rest of a planned move and sums its intervals, which is the time
+  // from the first step to the last.
+  PlannedMove runMove(HPSDMotionPlanner & planner)
+  {
+    PlannedMove move = { planner.getIntervalUs(), 0, 0xFFFFFFFF, 0, 0 };
+    uint64_t totalUs = 0;
+    uint32_t interval;
+    while ((interval = planner.nextInterval()) != 0)
+    {
+      totalUs += interval;
+      move.lastUs = interval;
+      if (interval < move.minUs) { move.minUs = interval; }
+      move.intervals++;
+    }
+    move.seconds = totalUs / 1e6;
+    return move;
+  }
+
+  // The time of a rest-to-rest trapezoid: v / a to accelerate and decelerate,
+  // and cruising for the rest.
+  double idealTrapezoid(double steps, double speed, double accel)
+  {
+    if (steps < speed * speed / accel) { return 2 * sqrt(steps / accel); }
+    return steps / speed + speed / accel;
+  }
+
+  // The time of a segment that starts at speed ve and ends at vx, peaking at
+  // vp or less.
+  double idealSegment(double steps, double ve, double vp, double vx, double accel)
+  {
+    double peak = sqrt((2 * accel * steps + ve * ve + vx * vx) / 2);
+    if (peak < vp) { vp = peak; }
+    double rampSteps = (2 * vp * vp - ve * ve - vx * vx) / (2 * accel);
+    return (2 * vp - ve - vx) / accel + (steps - rampSteps) / vp;
+  }
+
+  bool within(double actual, double expected, double fraction)
+  {
+    return fabs(actual - expected) <= fraction * expected;
+  }
+}
+
+TEST(plannerTrapezoidReachesMaxSpeed)
+{
+  // These used to level off well below the maximum speed, where the
+  // recurrence's steps became smaller than its rounding.
+  const uint32_t Cases[][2] = {
+    { 20000, 8000 }, { 40000, 20000 }, { 64000, 100000 }, { 200000, 1000000 },
+  };
+
+  for (const auto & c : Cases)
+  {
+    uint32_t speed = c[0], accel = c[1];
+    uint32_t steps = 4 * (uint32_t)((uint64_t)speed * speed / accel);
+
+    HPSDMotionPlanner planner;
+    planner.plan(steps, speed, accel);
+    PlannedMove move = runMove(planner);
+
+    CHECK_EQUAL(move.intervals, steps - 1);
+    CHECK(move.minUs <= (1000000 + speed / 2) / speed);
+    double ideal = idealTrapezoid(steps, speed, accel);
+    CHECK(fabs(move.seconds - ideal) < 0.01 * ideal);
+  }
+}
+
+TEST(plannerTrapezoidCruisesAtMaxSpeed)
+{
+  HPSDMotionPlanner planner;
+  planner.plan(100000, 64000, 100000);
+  while (!planner.isCruising() && !planner.isDone()) { planner.nextInterval(); }
+  CHECK(planner.isCruising());
+  CHECK_EQUAL(planner.getSpeed(), 64000);
+}
+
+TEST(plannerTrapezoidRampEndpoints)
+{
+  // Austin's first interval, 0.676 * sqrt(2 / a) seconds, and a deceleration
+  // that ends where the acceleration started.
+  HPSDMotionPlanner planner;
+  planner.plan(100000, 10000, 20000);
+  uint32_t c0 = (uint32_t)(0.676 * sqrt(2.0 / 20000) * 1e6 + 0.5);
+  CHECK(planner.getIntervalUs() + 1 >= c0 && planner.getIntervalUs() <= c0 + 1);
+  CHECK(planner.isAccelerating());
+
+  PlannedMove move = runMove(planner);
+  CHECK(move.lastUs + 1 >= move.firstUs && move.lastUs <= move.firstUs + 1);
+  CHECK(planner.isDone());
+}
+
+TEST(plannerTrapezoidShortMove)
+{
+  // Too short to reach the maximum speed: the peak is sqrt(a * steps).
+  HPSDMotionPlanner planner;
+  planner.plan(1000, 50000, 20000);
+  PlannedMove move = runMove(planner);
+  uint32_t peakUs = (uint32_t)(1e6 / sqrt(20000.0 * 1000) + 0.5);
+  CHECK(move.minUs + 2 >= peakUs && move.minUs <= peakUs + 2);
+  double ideal = idealTrapezoid(1000, 50000, 20000);
+  CHECK(fabs(move.seconds - ideal) < 0.03 * ideal);
+}
+
+TEST(plannerSCurveMatchesIdealTime)
+{
+  // Limiting the jerk adds a / j to the trapezoid's time.
+  HPSDMotionPlanner planner;
+  planner.plan(2000000, 200000, 1000000, 100000000);
+  PlannedMove move = runMove(planner);
+  CHECK_EQUAL(move.intervals, 2000000 - 1);
+  CHECK(move.minUs <= 5);
+  double ideal = idealTrapezoid(2000000, 200000, 1000000) + 1000000.0 / 100000000;
+  CHECK(fabs(move.seconds - ideal) < 0.01 * ideal);
+}
+
+TEST(plannerSCurveCruisesAtMaxSpeed)
+{
+  // Not faster: the cruise interval used to be rounded down to 1/16 us.
+  HPSDMotionPlanner planner;
+  planner.plan(1000000, 200000, 1000000, 1000000000);
+  while (!planner.isCruising() && !planner.isDone()) { planner.nextInterval(); }
+  CHECK(planner.isCruising());
+  CHECK_EQUAL(planner.getSpeed(), 200000);
+}
+
+TEST(plannerSegmentEntryAndExitSpeeds)
+{
+  // Cases: { steps, entry, max, exit, accel }, including segments that only
+  // accelerate, only decelerate, or never reach the maximum.
+  const uint32_t Cases[][5] = {
+    { 20000, 2000, 8000, 1000, 20000 },
+    { 20000, 5000, 8000, 5000, 20000 },
+    { 2000, 0, 8000, 4000, 20000 },
+    { 2000, 4000, 8000, 0, 20000 },
+    { 1000, 1000, 40000, 2000, 20000 },
+    { 5000, 20000, 20000, 20000, 100000 },
+  };
+
+  for (const auto & c : Cases)
+  {
+    HPSDMotionPlanner planner;
+    planner.planSegment(c[0], c[1], c[2], c[3], c[4]);
+    if (c[1] != 0) { CHECK(within(planner.getSpeed(), c[1], 0.02)); }
+
+    PlannedMove move = runMove(planner);
+    CHECK_EQUAL(move.intervals, c[0] - 1);
+    CHECK(move.minUs + 1 >= (uint32_t)(1e6 / c[2]));
+    if (c[3] != 0) { CHECK(within(move.lastUs, 1e6 / c[3], 0.03)); }
+    CHECK(within(move.seconds, idealSegment(c[0], c[1], c[2], c[3], c[4]), 0.02));
+  }
+}
+
+TEST(plannerSegmentCruisesAtMaxSpeed)
+{
+  HPSDMotionPlanner planner;
+  planner.planSegment(50000, 3000, 25000, 6000, 50000);
+  while (!planner.isCruising() && !planner.isDone()) { planner.nextInterval(); }
+  CHECK(planner.isCruising());
+  CHECK_EQUAL(planner.getSpeed(), 25000);
+}
+
+TEST(plannerConstantPeriod)
+{
+  HPSDMotionPlanner planner;
+  planner.planConstant(1000, 123);
+  PlannedMove move = runMove(planner);
+  CHECK_EQUAL(move.intervals, 999);
+  CHECK_EQUAL(move.minUs, 123);
+  CHECK_EQUAL(move.lastUs, 123);
+}
@@ -0,0 +1,109 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+// Checks the register encodings against the formulas of the original
+// library, which used a switch for MODE and a loop for ISGAIN and TORQUE.
+
+#include "HostTest.h"
+#include "HighPowerStepperDriver.h"
+#include "HPSDMockDRV8711.h"
+
+namespace
+{
+  uint8_t baselineModeBits(uint16_t microsteps)
+  {
+    switch (microsteps)
+    {
+    case 1:   return 0b0000;
+    case 2:   return 0b0001;
+    case 4:   return 0b0010;
+    case 8:   return 0b0011;
+    case 16:  return 0b0100;
+    case 32:  return 0b0101;
+    case 64:  return 0b0110;
+    case 128: return 0b0111;
+    case 256: return 0b1000;
+    default:  return 0b0010;
+    }
+  }
+
+  void baselineCurrent36v4(uint16_t current, uint8_t & isgainBits, uint8_t & torqueBits)
+  {
+    if (current > 8000) { current = 8000; }
+    isgainBits = 0b11;
+    uint16_t torque = ((uint32_t)768 * current) / 6875;
+    while (torque > 0xFF)
+    {
+      isgainBits--;
+      torque >>= 1;
+    }
+    torqueBits = torque;
+  }
+}
+
+TEST(modeBitsMatchesBaseline)
+{
+  for (uint32_t microsteps = 0; microsteps <= 1024; microsteps++)
+  {
+    if (!CHECK_EQUAL(HPSDRegs::modeBits(microsteps), baselineModeBits(microsteps))) { return; }
+  }
+  CHECK_EQUAL(HPSDRegs::modeBits(0xFFFF), 0b0010);
+}
+
+TEST(setStepModeWritesMode)
+{
+  HPSDMockDRV8711 mock;
+  HighPowerStepperDriver sd;
+  sd.driver.setTransport(&mock);
+  sd.resetSettings();
+
+  for (uint16_t microsteps = 1; microsteps <= 256; microsteps <<= 1)
+  {
+    sd.setStepMode(microsteps);
+    CHECK_EQUAL((mock.getRegister(HPSDMockDRV8711::CTRL) >> 3) & 0xF, baselineModeBits(microsteps));
+  }
+  sd.setStepMode(3);
+  CHECK_EQUAL((mock.getRegister(HPSDMockDRV8711::CTRL) >> 3) & 0xF, 0b0010);
+}
+
+TEST(boardCurrentMatchesBaseline)
+{
+  for (uint32_t current = 0; current <= 9000; current++)
+  {
+    uint8_t isgain, torque;
+    baselineCurrent36v4(current, isgain, torque);
+    bool ok = CHECK_EQUAL(HPSD36v4::isgainBits(current), isgain);
+    ok = CHECK_EQUAL(HPSD36v4::torqueBits(current), torque) && ok;
+    if (!ok) { return; }
+  }
+
+  static_assert(HPSD36v4::isgainBits(4000) == 0b10 && HPSD36v4::torqueBits(4000) == 223,
+    "HPSDBoard should be usable at compile time.");
+}
+
+TEST(setCurrentWritesIsgainAndTorque)
+{
+  HPSDMockDRV8711 mock;
+  HighPowerStepperDriver sd;
+  sd.driver.setTransport(&mock);
+  sd.resetSettings();
+
+  const uint16_t Currents[] = { 0, 100, 573, 1000, 1500, 2291, 4000, 6000, 8000, 8500 };
+  for (uint16_t current : Currents)
+  {
+    uint8_t isgain, torque;
+    baselineCurrent36v4(current, isgain, torque);
+    sd.setCurrentMilliamps36v4(current);
+    CHECK_EQUAL((mock.getRegister(HPSDMockDRV8711::CTRL) >> 8) & 0b11, isgain);
+    CHECK_EQUAL(mock.getRegister(HPSDMockDRV8711::TORQUE) & 0xFF, torque);
+    CHECK_EQUAL(sd.getGain(), isgain);
+    CHECK_EQUAL(sd.getTorque(), torque);
+  }
+}
+
+TEST(torqueAtFixedGainSaturates)
+{
+  // 4 A needs more than 8 bits of TORQUE at a gain of 40.
+  CHECK_EQUAL(HPSD36v4::torqueBitsAtGain(4000, 0b11), 0xFF);
+  CHECK_EQUAL(HPSD36v4::torqueBitsAtGain(4000, 0b01), ((uint32_t)768 * 4000 / 6875) >> 2);
+  CHECK_EQUAL(HPSD36v4::torqueBitsAtGain(400, 0b11), (uint32_t)768 * 400 / 6875);
+}
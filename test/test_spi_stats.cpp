@@ -0,0 +1,30 @@
+// Copyright Pololu Corporation.  For more information, see http://www.pololu.com/
+
+// Checks that HPSDSpiStats::format() fits in HPSDSpiStats::FormatSize.
+
+#include <string.h>
+#include "HostTest.h"
+#include "HPSDSpiStats.h"
+
+TEST(spiStatsFormatFitsFormatSize)
+{
+  HPSDSpiStats stats;
+  CHECK_EQUAL(stats.format(nullptr, 0), strlen(
+    "{\"r\":[0,0,0,0,0,0,0,0],\"rt\":[0,0,0,0,0,0,0,0],\"rm\":[0,0,0,0,0,0,0,0],"
+    "\"w\":[0,0,0,0,0,0,0,0],\"wt\":[0,0,0,0,0,0,0,0],\"wm\":[0,0,0,0,0,0,0,0],"
+    "\"b\":0,\"bt\":0,\"bm\":0,\"bw\":0,\"bwt\":0,\"bwm\":0,\"a\":0}"));
+
+  // The longest output: the counts are at their limits, and the durations
+  // are too long for 32 bits.
+  HPSDSpiStats::Counter full = { 0xFFFFFFFF, 0xFFFFFFFFFFFFFFFF, 0xFFFFFFFF };
+  for (uint8_t i = 0; i < 8; i++) { stats.reads[i] = stats.writes[i] = full; }
+  stats.batches = stats.busWaits = full;
+  stats.applySettingsCount = 0xFFFFFFFF;
+
+  char json[HPSDSpiStats::FormatSize];
+  int n = stats.format(json, sizeof(json));
+  CHECK(n < (int)sizeof(json));
+  CHECK_EQUAL(strlen(json), n);
+  CHECK_EQUAL(json[n - 1], '}');
+  CHECK(strstr(json, "\"bt\":4294967295,") != nullptr);
+}